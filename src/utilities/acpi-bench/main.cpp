@@ -0,0 +1,75 @@
+#include <karm/entry>
+
+import Vaerk.Acpi;
+import Karm.Cli;
+
+using namespace Karm;
+using namespace Karm::Literals;
+
+using namespace Vaerk;
+
+static volatile usize _sink = 0;
+
+// Sys::instant() has a microsecond resolution, runs are doubled until they
+// last long enough for it not to matter.
+static constexpr u64 MIN_USECS = 10000;
+
+template <typename F>
+void bench(Str name, usize iterations, usize bytes, F&& f) {
+    while (true) {
+        auto start = Sys::instant();
+        for (usize i = 0; i < iterations; i++)
+            _sink = _sink + f();
+        u64 usecs = (Sys::instant() - start).toUSecs();
+        if (usecs >= MIN_USECS) {
+            f64 nsecs = usecs * 1000.0 / iterations;
+            Sys::println("  {}: {} ns/op, {} MiB/s", name, nsecs, bytes / nsecs * 1000000000 / (1024 * 1024));
+            return;
+        }
+        iterations *= 2;
+    }
+}
+
+Async::Task<> entryPointAsync(Sys::Env& env, Async::CancellationToken) {
+    auto iterationsArg = Cli::option<usize>('n', "iterations"s, "Minimum iterations per measurement"s, 1000);
+
+    Cli::Command cmd{
+        "acpi-bench"s,
+        "Compare the vectorized table checksum against the scalar loop"s,
+        {
+            Cli::Section{"Measurement"s, {iterationsArg}},
+        }
+    };
+
+    co_try$(cmd.exec(env));
+    if (not cmd)
+        co_return Ok();
+
+    usize iterations = max(iterationsArg.value(), 1uz);
+
+    // From a FADT sized table up to a large DSDT, with an odd tail.
+    Array sizes = {276uz, 4096uz + 7, 64 * 1024uz + 13, 512 * 1024uz + 3};
+
+    Vec<u8> buf;
+    buf.resize(last(sizes));
+    u32 state = 0x12345678;
+    for (auto& b : buf) {
+        state = state * 1664525 + 1013904223;
+        b = state >> 24;
+    }
+
+    for (auto size : sizes) {
+        if (Acpi::checksum(buf.buf(), size) != Acpi::checksumScalar(buf.buf(), size))
+            co_return Error::other("checksum mismatch");
+
+        Sys::println("{} bytes:", size);
+        bench("scalar", iterations, size, [&] {
+            return Acpi::checksumScalar(buf.buf(), size);
+        });
+        bench("vectorized", iterations, size, [&] {
+            return Acpi::checksum(buf.buf(), size);
+        });
+    }
+
+    co_return Ok();
+}
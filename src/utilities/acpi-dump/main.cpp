@@ -0,0 +1,259 @@
+#include <karm/entry>
+
+import Vaerk.Acpi;
+import Karm.Cli;
+
+using namespace Karm;
+using namespace Karm::Literals;
+
+using namespace Vaerk;
+
+static Str _str(Slice<char> chars) {
+    return Str{chars.buf(), chars.len()};
+}
+
+// MARK: Loading ---------------------------------------------------------------
+
+struct Tables {
+    Vec<Sys::Mmap> maps;
+    Vec<Vec<u8>> files;
+    Vec<Acpi::Sdth const*> tables;
+    usize skipped = 0;
+};
+
+// The RSDP and FACS don't share the common header and checksum, they are
+// stepped over.
+static Opt<usize> _skipLen(Bytes bytes) {
+    if (bytes.len() >= sizeof(Acpi::Rsdp) and
+        _str(Slice<char>{reinterpret_cast<char const*>(bytes.buf()), 8}) == _str(Acpi::Rsdp::SIGNATURE)) {
+        auto const* rsdp = reinterpret_cast<Acpi::Rsdp const*>(bytes.buf());
+        return rsdp->isAcpi2() ? rsdp->length : 20;
+    }
+
+    if (bytes.len() >= 8 and _str(Slice<char>{reinterpret_cast<char const*>(bytes.buf()), 4}) == "FACS"s)
+        return reinterpret_cast<Acpi::Sdth const*>(bytes.buf())->len;
+
+    return NONE;
+}
+
+// Split a binary dump made of tables laid end to end.
+static Res<> _split(Bytes bytes, Tables& out) {
+    usize off = 0;
+    while (off < bytes.len()) {
+        auto rest = sub(bytes, off, bytes.len());
+
+        if (auto skip = _skipLen(rest)) {
+            if (*skip == 0 or *skip > rest.len())
+                return Error::invalidData("truncated table in dump");
+            out.skipped++;
+            off += *skip;
+            continue;
+        }
+
+        if (rest.len() < sizeof(Acpi::Sdth))
+            return Error::invalidData("truncated table header in dump");
+
+        auto const* table = reinterpret_cast<Acpi::Sdth const*>(rest.buf());
+        if (table->len < sizeof(Acpi::Sdth) or table->len > rest.len())
+            return Error::invalidData("table length out of bounds in dump");
+
+        out.tables.pushBack(table);
+        off += table->len;
+    }
+    return Ok();
+}
+
+// Sysfs tables can't be mapped, so they are read into memory instead.
+static Res<Vec<u8>> _readAll(Ref::Url const& url) {
+    auto file = try$(Sys::File::open(url));
+    return Io::readAll(file);
+}
+
+static Res<> _load(Sys::Env& env, Str path, Tables& out) {
+    auto url = Ref::parseUrlOrPath(path, env.cwd());
+
+    auto dir = Sys::Dir::open(url);
+    if (not dir) {
+        auto file = try$(Sys::File::open(url));
+        auto map = try$(Sys::mmap(file));
+        try$(_split(map.bytes(), out));
+        out.maps.pushBack(std::move(map));
+        return Ok();
+    }
+
+    for (auto const& entry : dir.unwrap().entries()) {
+        if (entry.type != Sys::Type::FILE)
+            continue;
+        out.files.pushBack(try$(_readAll(url / entry.name)));
+        auto const& file = last(out.files);
+        try$(_split(Bytes{file.buf(), file.len()}, out));
+    }
+
+    return Ok();
+}
+
+// MARK: Tables ----------------------------------------------------------------
+
+void dumpTables(Slice<Acpi::Sdth const*> tables) {
+    Sys::println("Tables:");
+    for (auto const* table : tables) {
+        Sys::println(
+            " - {} len:{} rev:{} oem:{} {} checksum:{}",
+            _str(table->signature),
+            table->len,
+            table->revision,
+            _str(table->oemId),
+            _str(table->oemTableId),
+            table->isValid() ? "ok" : "BAD"
+        );
+    }
+}
+
+void dumpMadt(Acpi::Madt const& madt) {
+    Acpi::CpuTopology topo;
+    topo.load(madt);
+
+    Sys::println("MADT: lapic:{:x} flags:{:x}", topo.lapicAddress, madt.flags);
+    for (auto const& cpu : topo.cpuList())
+        Sys::println(" - cpu id:{} uid:{}{}", cpu.id, cpu.uid, cpu.enabled ? "" : " (online capable)");
+    for (auto const& ioapic : topo.ioapicList())
+        Sys::println(" - ioapic id:{} address:{:x} gsi:{}", ioapic.id, ioapic.address, ioapic.gsiBase);
+    for (auto const& iso : topo.overrideList())
+        Sys::println(" - override bus:{} irq:{} gsi:{} flags:{:x}", iso.bus, iso.irq, iso.gsi, iso.flags);
+    if (topo.dropped)
+        Sys::println(" ! {} record(s) did not fit", topo.dropped);
+}
+
+void dumpMcfg(Acpi::Mcfg const& mcfg) {
+    Sys::println("MCFG:");
+    for (usize i = 0; i < mcfg.count(); i++) {
+        auto const& record = mcfg.records[i];
+        Sys::println(" - segment:{} bus:{}-{} address:{:x}", record.segmentGroup, record.busStart, record.busEnd, record.address);
+    }
+}
+
+void dumpFadt(Acpi::Fadt const& fadt) {
+    Sys::println("FADT: dsdt:{:x} sci:{} pm-timer:{:x} century:{}", fadt.dsdt, fadt.sciInt, fadt.pmTmrBlk, fadt.century);
+    Sys::println(
+        " - legacy devices:{} 8042:{} cmos rtc:{}",
+        fadt.hasLegacyDevices() ? "yes" : "no",
+        fadt.has8042() ? "yes" : "no",
+        fadt.hasCmosRtc() ? "yes" : "no"
+    );
+}
+
+void dumpHpet(Acpi::Hpet const& hpet) {
+    Sys::println("HPET: number:{} address:{:x} min-tick:{}", hpet.hpetNumber, hpet.address, hpet.minimumTick);
+}
+
+void dumpSrat(Acpi::Srat const& srat, Acpi::Slit const* slit) {
+    Acpi::NumaTopology numa;
+    numa.load(srat, slit);
+
+    Sys::println("SRAT: {} node(s){}", numa.nodes(), slit ? ", distances from SLIT" : "");
+    for (usize node = 0; node < numa.nodes(); node++) {
+        usize cpus = 0;
+        numa.cpusOf(node, [&](auto const&) {
+            cpus++;
+        });
+        Sys::println(" - node {} (domain {}): {} cpu(s)", node, numa.domains[node], cpus);
+        numa.memoryOf(node, [&](auto const& range) {
+            Sys::println("   memory {:x}-{:x}{}", range.start, range.end(), range.hotPluggable ? " (hot pluggable)" : "");
+        });
+    }
+
+    for (usize from = 0; from < numa.nodes(); from++) {
+        Io::StringWriter row;
+        for (usize to = 0; to < numa.nodes(); to++)
+            (void)Io::format(row, " {}", numa.distance(from, to));
+        Sys::println(" - distances {}:{}", from, row.str());
+    }
+    if (numa.dropped)
+        Sys::println(" ! {} record(s) did not fit", numa.dropped);
+}
+
+// MARK: Timing ----------------------------------------------------------------
+
+static volatile usize _sink = 0;
+
+// Sys::instant() has a microsecond resolution, runs are doubled until they
+// last long enough for it not to matter.
+static constexpr u64 MIN_USECS = 10000;
+
+template <typename F>
+f64 _nsPerOp(usize iterations, F&& f) {
+    while (true) {
+        auto start = Sys::instant();
+        for (usize i = 0; i < iterations; i++)
+            f();
+        u64 usecs = (Sys::instant() - start).toUSecs();
+        if (usecs >= MIN_USECS)
+            return usecs * 1000.0 / iterations;
+        iterations *= 2;
+    }
+}
+
+void timeRegistry(Slice<Acpi::Sdth const*> tables, usize iterations) {
+    auto enumeration = _nsPerOp(iterations, [&] {
+        _sink = _sink + Acpi::Registry::from(tables).tables().len();
+    });
+    Sys::println("Enumeration: {} ns/op", enumeration);
+
+    auto registry = Acpi::Registry::from(tables);
+    auto lookup = _nsPerOp(iterations, [&] {
+        _sink = _sink + (registry.find<Acpi::Madt>() != nullptr) + (registry.find<Acpi::Mcfg>() != nullptr) +
+                (registry.find<Acpi::Fadt>() != nullptr) + (registry.find<Acpi::Hpet>() != nullptr) +
+                (registry.find<Acpi::Srat>() != nullptr) + (registry.find<Acpi::Slit>() != nullptr);
+    });
+    Sys::println("Lookup: {} ns/op", lookup / 6);
+}
+
+Async::Task<> entryPointAsync(Sys::Env& env, Async::CancellationToken) {
+    auto inputArg = Cli::operand<Str>("input"s, "Binary table dump, or a directory of tables like /sys/firmware/acpi/tables"s);
+    auto timeArg = Cli::flag('t', "time"s, "Time enumeration and lookups"s);
+    auto iterationsArg = Cli::option<usize>('n', "iterations"s, "Minimum iterations per measurement"s, 1000);
+
+    Cli::Command cmd{
+        "acpi-dump"s,
+        "Dump and validate ACPI tables"s,
+        {
+            Cli::Section{"Input"s, {inputArg}},
+            Cli::Section{"Output"s, {timeArg, iterationsArg}},
+        }
+    };
+
+    co_try$(cmd.exec(env));
+    if (not cmd)
+        co_return Ok();
+
+    if (not inputArg.value())
+        co_return Error::invalidInput("no acpi tables provided");
+
+    Tables input;
+    co_try$(_load(env, inputArg.value(), input));
+
+    dumpTables(input.tables);
+    if (input.skipped)
+        Sys::println("Skipped {} RSDP/FACS structure(s)", input.skipped);
+
+    auto registry = Acpi::Registry::from(input.tables);
+
+    if (auto* madt = registry.find<Acpi::Madt>())
+        dumpMadt(*madt);
+    if (auto* mcfg = registry.find<Acpi::Mcfg>())
+        dumpMcfg(*mcfg);
+    if (auto* fadt = registry.find<Acpi::Fadt>())
+        dumpFadt(*fadt);
+    if (auto* hpet = registry.find<Acpi::Hpet>())
+        dumpHpet(*hpet);
+    if (auto* srat = registry.find<Acpi::Srat>())
+        dumpSrat(*srat, registry.find<Acpi::Slit>());
+
+    if (timeArg.value())
+        timeRegistry(input.tables, max(iterationsArg.value(), 1uz));
+
+    if (registry.rejected())
+        co_return Error::invalidData("some tables failed validation");
+
+    co_return Ok();
+}
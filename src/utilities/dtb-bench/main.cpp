@@ -0,0 +1,269 @@
+#include <karm/entry>
+
+import Vaerk.Dtb;
+import Karm.Cli;
+
+using namespace Karm;
+using namespace Karm::Literals;
+using namespace Karm::Re::Literals;
+
+using namespace Vaerk;
+
+// MARK: Synthetic trees -------------------------------------------------------
+
+struct Shape {
+    usize depth;
+    usize fanout;
+    usize props;
+};
+
+struct Synthetic {
+    Vec<u8> buf;
+    Bytes dtb;
+    String deepestPath;
+    u32 lastPhandle = 0;
+};
+
+Res<> _generateNode(Dtb::Writer& w, Shape shape, usize level, Synthetic& out) {
+    try$(w.prop("compatible"s, "vaerk,synthetic"s));
+    try$(w.prop("phandle"s, ++out.lastPhandle));
+    for (usize i = 0; i < shape.props; i++)
+        try$(w.prop(Io::format("prop-{}", i), static_cast<u32>(i)));
+
+    if (level == shape.depth)
+        return Ok();
+
+    for (usize i = 0; i < shape.fanout; i++) {
+        try$(w.beginNode(Io::format("node@{:x}", i)));
+        try$(_generateNode(w, shape, level + 1, out));
+        try$(w.endNode());
+    }
+    return Ok();
+}
+
+Res<Synthetic> generate(Shape shape) {
+    usize nodes = 1;
+    usize width = 1;
+    for (usize i = 0; i < shape.depth; i++) {
+        width *= shape.fanout;
+        nodes += width;
+    }
+
+    Synthetic out;
+    out.buf.resize(nodes * (96 + shape.props * 16) + 4096);
+
+    Dtb::Writer w{MutBytes{out.buf.buf(), out.buf.len()}};
+    try$(w.reserve(0x80000000, 0x200000));
+    try$(w.beginNode(""s));
+    try$(w.prop("#address-cells"s, 2u));
+    try$(w.prop("#size-cells"s, 2u));
+
+    try$(w.beginNode("chosen"s));
+    try$(w.prop("linux,initrd-start"s, u64(0x84000000)));
+    try$(w.prop("linux,initrd-end"s, u64(0x85000000)));
+    try$(w.endNode());
+
+    try$(_generateNode(w, shape, 0, out));
+    try$(w.endNode());
+
+    out.dtb = try$(w.finish());
+
+    Io::StringWriter path;
+    for (usize i = 0; i < shape.depth; i++)
+        try$(Io::format(path, "/node@{:x}", shape.fanout - 1));
+    out.deepestPath = path.take();
+
+    return Ok(std::move(out));
+}
+
+// MARK: Benchmarks ------------------------------------------------------------
+
+static volatile usize _sink = 0;
+
+// Sys::instant() has a microsecond resolution, runs are doubled until they
+// last long enough for it not to matter.
+static constexpr u64 MIN_USECS = 10000;
+
+template <typename F>
+void bench(Str name, usize iterations, F&& f) {
+    while (true) {
+        auto start = Sys::instant();
+        for (usize i = 0; i < iterations; i++)
+            _sink = _sink + f();
+        u64 usecs = (Sys::instant() - start).toUSecs();
+        if (usecs >= MIN_USECS) {
+            Sys::println("  {}: {} ns/op", name, usecs * 1000.0 / iterations);
+            return;
+        }
+        iterations *= 2;
+    }
+}
+
+usize _walk(Dtb::Node const& node) {
+    usize count = 1;
+    for (auto prop : node.iterProp())
+        count += prop.raw().len();
+    for (auto child : node.iterChildren())
+        count += _walk(child);
+    return count;
+}
+
+Opt<Dtb::Node> _lookup(Dtb::Node node, Str path) {
+    Io::SScan s{path};
+    while (not s.ended()) {
+        s.skip(Re::zeroOrMore('/'_re));
+        auto component = s.token(Re::until('/'_re));
+        if (not component)
+            continue;
+        Opt<Dtb::Node> found = NONE;
+        for (auto child : node.iterChildren()) {
+            if (child.fullname() == component) {
+                found = child;
+                break;
+            }
+        }
+        node = try$(found);
+    }
+    return Some(node);
+}
+
+// Follow the last child at every level, the worst case for a path lookup.
+String _deepestPath(Dtb::Node node) {
+    Io::StringWriter path;
+    while (true) {
+        Opt<Dtb::Node> lastChild = NONE;
+        for (auto child : node.iterChildren())
+            lastChild = child;
+        if (not lastChild)
+            break;
+        node = lastChild.unwrap();
+        (void)Io::format(path, "/{}", node.fullname());
+    }
+    return path.take();
+}
+
+Res<> run(Dtb::Blob& dtb, Str path, u32 phandle, usize iterations) {
+    auto size = Dtb::Index::measure(dtb);
+    Sys::println(
+        "  {} nodes, {} properties, {} phandles, structure {}, strings {}",
+        size.nodes, size.props, size.phandles,
+        DataSize{dtb.header().structureBlockSize},
+        DataSize{dtb.header().stringsBlockSize}
+    );
+
+    bench("full traversal"s, iterations, [&] {
+        return _walk(dtb.root());
+    });
+
+    bench("dump"s, iterations, [&] {
+        Io::StringWriter sw;
+        Io::Emit e{sw};
+        dtb.dump(e);
+        return sw.take().len();
+    });
+
+    bench("initrd()"s, iterations, [&] {
+        return dtb.initrd() ? 1uz : 0uz;
+    });
+
+    bench("path lookup"s, iterations, [&] {
+        return _lookup(dtb.root(), path) ? 1uz : 0uz;
+    });
+
+    bench("phandle lookup"s, iterations, [&] {
+        return dtb.byPhandle(phandle) ? 1uz : 0uz;
+    });
+
+    bench("validate()"s, iterations, [&] {
+        auto fresh = Dtb::Blob::open(dtb.bytes()).unwrap();
+        return fresh.validate() ? 1uz : 0uz;
+    });
+
+    Vec<Dtb::IndexNode> nodes;
+    Vec<Dtb::IndexProp> props;
+    Vec<Dtb::IndexKey> phandles;
+    Vec<Dtb::IndexKey> names;
+    nodes.resize(size.nodes);
+    props.resize(size.props);
+    phandles.resize(size.phandles);
+    names.resize(size.nodes);
+
+    Dtb::Index::Arena arena{
+        {nodes.buf(), nodes.len()},
+        {props.buf(), props.len()},
+        {phandles.buf(), phandles.len()},
+        {names.buf(), names.len()},
+    };
+
+    bench("index build"s, iterations, [&] {
+        return Dtb::Index::build(dtb, arena) ? 1uz : 0uz;
+    });
+
+    auto index = try$(Dtb::Index::build(dtb, arena));
+    usize arenaSize =
+        nodes.len() * sizeof(Dtb::IndexNode) +
+        props.len() * sizeof(Dtb::IndexProp) +
+        (phandles.len() + names.len()) * sizeof(Dtb::IndexKey);
+    Sys::println("  index arena: {}", DataSize{arenaSize});
+
+    bench("index path lookup"s, iterations, [&] {
+        return index.byPath(path) ? 1uz : 0uz;
+    });
+
+    bench("index phandle lookup"s, iterations, [&] {
+        return index.byPhandle(phandle) ? 1uz : 0uz;
+    });
+
+    return Ok();
+}
+
+Async::Task<> entryPointAsync(Sys::Env& env, Async::CancellationToken) {
+    auto inputArg = Cli::operand<Str>("input"s, "Recorded device tree blob to measure, a synthetic tree is used if omitted"s);
+    auto depthArg = Cli::option<usize>('d', "depth"s, "Depth of the synthetic tree"s, 4);
+    auto fanoutArg = Cli::option<usize>('f', "fanout"s, "Children per node of the synthetic tree"s, 8);
+    auto propsArg = Cli::option<usize>('p', "props"s, "Extra properties per node of the synthetic tree"s, 4);
+    auto iterationsArg = Cli::option<usize>('n', "iterations"s, "Minimum iterations per measurement"s, 100);
+
+    Cli::Command cmd{
+        "dtb-bench"s,
+        "Measure the device tree parser"s,
+        {
+            Cli::Section{"Input"s, {inputArg}},
+            Cli::Section{"Synthetic tree"s, {depthArg, fanoutArg, propsArg}},
+            Cli::Section{"Measurement"s, {iterationsArg}},
+        }
+    };
+
+    co_try$(cmd.exec(env));
+    if (not cmd)
+        co_return Ok();
+
+    usize iterations = max(iterationsArg.value(), 1uz);
+
+    if (inputArg.value()) {
+        auto url = Ref::parseUrlOrPath(inputArg.value(), env.cwd());
+        auto file = co_try$(Sys::File::open(url));
+        auto map = co_try$(Sys::mmap(file));
+        auto dtb = co_try$(Dtb::Blob::open(map.bytes()));
+
+        // Measure the lookups against the last node and phandle of the tree.
+        auto path = _deepestPath(dtb.root());
+        u32 phandle = 0;
+        auto index = dtb.index();
+        if (index._phandles.len())
+            phandle = last(index._phandles).key;
+
+        Sys::println("{}:", inputArg.value());
+        co_try$(run(dtb, path, phandle, iterations));
+        co_return Ok();
+    }
+
+    Shape shape{depthArg.value(), fanoutArg.value(), propsArg.value()};
+    auto synthetic = co_try$(generate(shape));
+    auto dtb = co_try$(Dtb::Blob::open(synthetic.dtb));
+
+    Sys::println("synthetic depth:{} fanout:{} props:{}:", shape.depth, shape.fanout, shape.props);
+    co_try$(run(dtb, synthetic.deepestPath, synthetic.lastPhandle, iterations));
+
+    co_return Ok();
+}
@@ -8,14 +8,205 @@ using namespace Karm::Literals;
 
 using namespace Vaerk;
 
+Res<Dtb::Blob> _open(Sys::Env& env, Str path, Vec<Sys::Mmap>& maps) {
+    auto url = Ref::parseUrlOrPath(path, env.cwd());
+    auto file = try$(Sys::File::open(url));
+    auto map = try$(Sys::mmap(file));
+    auto dtb = try$(Dtb::Blob::open(map.bytes()));
+    try$(dtb.validate());
+    maps.pushBack(std::move(map));
+    return Ok(dtb);
+}
+
+// MARK: Paths -----------------------------------------------------------------
+
+// Both modes walk the flattened index of the tree rather than recursing
+// through it, nodes come in document order so parents are seen first.
+struct Tree {
+    Dtb::Index index;
+    Vec<String> paths;
+    Vec<usize> depths;
+
+    struct Key {
+        Str path;
+        u32 node;
+    };
+
+    Vec<Key> keys; // Sorted by path
+
+    static Tree build(Dtb::Blob const& dtb) {
+        Tree tree{dtb.index()};
+        for (u32 i = 0; i < tree.index.len(); i++) {
+            auto parent = tree.index[i].parent;
+            if (parent == Dtb::IndexNode::NIL) {
+                tree.paths.pushBack(String{});
+                tree.depths.pushBack(1);
+            } else {
+                tree.paths.pushBack(Io::format("{}/{}", tree.paths[parent], tree.index[i].fullname));
+                tree.depths.pushBack(tree.depths[parent] + 1);
+            }
+        }
+
+        for (u32 i = 0; i < tree.index.len(); i++)
+            tree.keys.pushBack({tree.paths[i], i});
+        sort(tree.keys, [](Key const& a, Key const& b) {
+            return a.path <=> b.path;
+        });
+        return tree;
+    }
+
+    Str path(u32 node) const {
+        if (node == 0)
+            return "/"s;
+        return paths[node];
+    }
+
+    Opt<u32> byPath(Str path) const {
+        usize lo = 0, hi = keys.len();
+        while (lo < hi) {
+            usize mid = lo + (hi - lo) / 2;
+            if (keys[mid].path < path)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo >= keys.len() or keys[lo].path != path)
+            return NONE;
+        return Some(keys[lo].node);
+    }
+};
+
+// MARK: Stats -----------------------------------------------------------------
+
+void dumpStats(Dtb::Blob const& dtb) {
+    auto tree = Tree::build(dtb);
+
+    usize props = 0;
+    usize valueBytes = 0;
+    usize maxDepth = 0;
+    for (u32 i = 0; i < tree.index.len(); i++) {
+        maxDepth = max(maxDepth, tree.depths[i]);
+        for (auto const& prop : tree.index.props(i)) {
+            props++;
+            valueBytes += prop.value.len();
+        }
+    }
+
+    Vec<Str> strings;
+    auto block = dtb.stringsBlock();
+    usize start = 0;
+    for (usize i = 0; i < block.len(); i++) {
+        if (block[i] != 0)
+            continue;
+        strings.pushBack(Str{reinterpret_cast<char const*>(block.buf()) + start, i - start});
+        start = i + 1;
+    }
+
+    sort(strings);
+    usize duplicates = 0;
+    usize duplicateBytes = 0;
+    for (usize i = 1; i < strings.len(); i++) {
+        if (strings[i] == strings[i - 1]) {
+            duplicates++;
+            duplicateBytes += strings[i].len() + 1;
+        }
+    }
+
+    auto const& header = dtb.header();
+    Sys::println("total size: {}", DataSize{header.totalSize});
+    Sys::println("structure block: {}", DataSize{header.structureBlockSize});
+    Sys::println("strings block: {}", DataSize{header.stringsBlockSize});
+    Sys::println("memory reservations: {}", dtb.memoryReservations().len());
+    Sys::println("nodes: {}", tree.index.len());
+    Sys::println("properties: {}", props);
+    Sys::println("property values: {}", DataSize{valueBytes});
+    Sys::println("max depth: {}", maxDepth);
+    Sys::println("strings: {}", strings.len());
+    Sys::println("duplicate strings: {} ({})", duplicates, DataSize{duplicateBytes});
+}
+
+// MARK: Diff ------------------------------------------------------------------
+
+bool _sameBytes(Bytes a, Bytes b) {
+    if (a.len() != b.len())
+        return false;
+    for (usize i = 0; i < a.len(); i++) {
+        if (a[i] != b[i])
+            return false;
+    }
+    return true;
+}
+
+usize _diffProps(Tree const& a, u32 i, Tree const& b, u32 j) {
+    usize changes = 0;
+    Str where = a.path(i);
+
+    for (auto const& prop : a.index.props(i)) {
+        auto other = b.index.getProperty(j, prop.name);
+        if (not other) {
+            Sys::println("- {}:{}", where, prop.name);
+            changes++;
+        } else if (not _sameBytes(prop.value, other->raw())) {
+            Sys::println("~ {}:{}", where, prop.name);
+            changes++;
+        }
+    }
+
+    for (auto const& prop : b.index.props(j)) {
+        if (not a.index.getProperty(i, prop.name)) {
+            Sys::println("+ {}:{}", where, prop.name);
+            changes++;
+        }
+    }
+
+    return changes;
+}
+
+// Nodes are matched by path, a missing node is only reported once, at the
+// top of the missing subtree.
+usize diff(Tree const& a, Tree const& b) {
+    usize changes = 0;
+
+    for (u32 i = 0; i < a.index.len(); i++) {
+        if (auto j = b.byPath(a.paths[i])) {
+            changes += _diffProps(a, i, b, *j);
+            continue;
+        }
+        auto parent = a.index[i].parent;
+        if (parent == Dtb::IndexNode::NIL or b.byPath(a.paths[parent])) {
+            Sys::println("- {}", a.path(i));
+            changes++;
+        }
+    }
+
+    for (u32 j = 0; j < b.index.len(); j++) {
+        if (a.byPath(b.paths[j]))
+            continue;
+        auto parent = b.index[j].parent;
+        if (parent == Dtb::IndexNode::NIL or a.byPath(b.paths[parent])) {
+            Sys::println("+ {}", b.path(j));
+            changes++;
+        }
+    }
+
+    return changes;
+}
+
+// MARK: Entry point -----------------------------------------------------------
+
 Async::Task<> entryPointAsync(Sys::Env& env, Async::CancellationToken) {
     auto inputArg = Cli::operand<Str>("dtb-dump"s, "Path to the device tree blob"s);
+    auto jsonArg = Cli::flag('j', "json"s, "Output the tree as JSON"s);
+    auto dtsArg = Cli::flag('s', "dts"s, "Output the tree as device tree source"s);
+    auto statsArg = Cli::flag('S', "stats"s, "Report node, property and string block statistics"s);
+    auto diffArg = Cli::option<Str>('d', "diff"s, "Structurally compare with another device tree blob"s, ""s);
 
     Cli::Command cmd{
         "dtb-dump"s,
         "Dump a device tree blob"s,
         {
             Cli::Section{"Input"s, {inputArg}},
+            Cli::Section{"Output"s, {jsonArg, dtsArg, statsArg, diffArg}},
         }
     };
 
@@ -26,13 +217,30 @@ Async::Task<> entryPointAsync(Sys::Env& env, Async::CancellationToken) {
     if (not inputArg.value())
         co_return Error::invalidInput("no dtb file provided");
 
-    auto url = Ref::parseUrlOrPath(inputArg.value(), env.cwd());
-    auto file = co_try$(Sys::File::open(url));
-    auto map = co_try$(Sys::mmap(file));
-    auto dtb = co_try$(Dtb::Blob::open(map.bytes()));
+    Vec<Sys::Mmap> maps;
+    auto dtb = co_try$(_open(env, inputArg.value(), maps));
+
+    if (diffArg.value()) {
+        auto other = co_try$(_open(env, diffArg.value(), maps));
+        auto changes = diff(Tree::build(dtb), Tree::build(other));
+        Sys::println("{} difference(s)", changes);
+        if (changes)
+            co_return Error::other("device trees differ");
+        co_return Ok();
+    }
+
+    if (statsArg.value()) {
+        dumpStats(dtb);
+        co_return Ok();
+    }
 
     Io::Emit e{Sys::out()};
-    dtb.dump(e);
+    if (jsonArg.value())
+        Dtb::dumpJson(dtb, e);
+    else if (dtsArg.value())
+        Dtb::dumpDts(dtb, e);
+    else
+        dtb.dump(e);
 
     co_return Ok();
 }
@@ -0,0 +1,226 @@
+#include <karm/entry>
+
+import Vaerk.Dtb;
+import Karm.Cli;
+
+using namespace Karm;
+using namespace Karm::Literals;
+
+using namespace Vaerk;
+
+// MARK: Harness ---------------------------------------------------------------
+
+static volatile usize _sink = 0;
+
+// Touch every accessor that reads property payloads, returns the number of
+// nodes visited.
+usize _visit(Dtb::Node const& node) {
+    usize nodes = 1;
+    for (auto prop : node.iterProp()) {
+        _sink = _sink + usize(prop.sniff());
+        if (auto cell = prop.cell<Dtb::AddressSizeCell>())
+            _sink = _sink + cell.unwrap().start + cell.unwrap().size;
+        for (auto str : prop.iterStr())
+            _sink = _sink + str.len();
+    }
+    for (auto child : node.iterChildren())
+        nodes += _visit(child);
+    return nodes;
+}
+
+// Run the parser over an untrusted blob, first with the per-token checks,
+// then trusted if it passes validation.
+usize fuzz(Bytes input) {
+    auto maybeDtb = Dtb::Blob::open(input);
+    if (not maybeDtb)
+        return 0;
+    auto& dtb = maybeDtb.unwrap();
+
+    Io::StringWriter sw;
+    Io::Emit e{sw};
+    dtb.root().dump(e);
+    usize nodes = _visit(dtb.root());
+
+    if (not dtb.validate())
+        return nodes;
+
+    Dtb::dumpDts(dtb, e);
+    Dtb::dumpJson(dtb, e);
+    _sink = _sink + sw.take().len();
+    return nodes + _visit(dtb.root());
+}
+
+// Entry point for fuzzing drivers like libFuzzer or AFL++, when the harness
+// is linked against one of them instead of the karm entry point.
+extern "C" int LLVMFuzzerTestOneInput(u8 const* data, usize size) {
+    fuzz(Bytes{data, size});
+    return 0;
+}
+
+// MARK: Mutations -------------------------------------------------------------
+
+struct Rng {
+    u64 _state;
+
+    u64 next() {
+        _state ^= _state << 13;
+        _state ^= _state >> 7;
+        _state ^= _state << 17;
+        return _state;
+    }
+
+    usize below(usize n) {
+        return n ? next() % n : 0;
+    }
+};
+
+// Values that tend to sit on the edge of a bounds check.
+static constexpr Array<u32, 8> INTERESTING = {
+    0, 1, 2, 3, 4, 9, 0x7fffffff, 0xffffffff
+};
+
+static void _putU32be(MutBytes bytes, usize off, u32 value) {
+    for (usize i = 0; i < 4; i++)
+        bytes[off + i] = value >> (24 - i * 8);
+}
+
+// Derive a new input from a seed. The total size is kept consistent with
+// the header most of the time, otherwise every mutation would stop at
+// Blob::open().
+void mutate(Rng& rng, Bytes seed, Vec<u8>& out) {
+    out.clear();
+    for (auto b : seed)
+        out.pushBack(b);
+
+    usize rounds = 1 + rng.below(4);
+    for (usize r = 0; r < rounds and out.len() >= 4; r++) {
+        MutBytes bytes{out.buf(), out.len()};
+        usize aligned = rng.below(out.len() / 4) * 4;
+        switch (rng.below(4)) {
+        case 0:
+            bytes[rng.below(out.len())] ^= 1 << rng.below(8);
+            break;
+        case 1:
+            _putU32be(bytes, aligned, INTERESTING[rng.below(INTERESTING.len())]);
+            break;
+        case 2:
+            _putU32be(bytes, aligned, (u32)rng.next());
+            break;
+        case 3:
+            while (out.len() > aligned)
+                out.popBack();
+            break;
+        }
+    }
+
+    if (out.len() >= 8 and rng.below(8) != 0)
+        _putU32be(MutBytes{out.buf(), out.len()}, 4, (u32)out.len());
+}
+
+// MARK: Corpus ----------------------------------------------------------------
+
+struct Seed {
+    String name;
+    Vec<u8> bytes;
+};
+
+static Res<Vec<u8>> _readAll(Ref::Url const& url) {
+    auto file = try$(Sys::File::open(url));
+    return Io::readAll(file);
+}
+
+Res<Vec<Seed>> loadCorpus(Sys::Env& env, Str path) {
+    auto url = Ref::parseUrlOrPath(path, env.cwd());
+    Vec<Seed> corpus;
+
+    auto dir = Sys::Dir::open(url);
+    if (not dir) {
+        corpus.pushBack({path, try$(_readAll(url))});
+        return Ok(corpus);
+    }
+
+    for (auto const& entry : dir.unwrap().entries()) {
+        if (entry.type != Sys::Type::FILE)
+            continue;
+        corpus.pushBack({entry.name, try$(_readAll(url / entry.name))});
+    }
+
+    if (corpus.len() == 0)
+        return Error::invalidInput("empty corpus");
+
+    return Ok(corpus);
+}
+
+// MARK: Benchmark -------------------------------------------------------------
+
+// Sys::instant() has a microsecond resolution, runs are doubled until they
+// last long enough for it not to matter.
+static constexpr u64 MIN_USECS = 100000;
+
+void bench(Seed const& seed, usize iterations) {
+    Bytes input{seed.bytes.buf(), seed.bytes.len()};
+    while (true) {
+        usize nodes = 0;
+        auto start = Sys::instant();
+        for (usize i = 0; i < iterations; i++)
+            nodes += fuzz(input);
+        u64 usecs = (Sys::instant() - start).toUSecs();
+        if (usecs >= MIN_USECS) {
+            Sys::println("  {}: {} nodes/s", seed.name, nodes * 1000000 / usecs);
+            return;
+        }
+        iterations *= 2;
+    }
+}
+
+Async::Task<> entryPointAsync(Sys::Env& env, Async::CancellationToken) {
+    auto corpusArg = Cli::operand<Str>("corpus"s, "Seed blob, or a directory of seeds like src/utilities/dtb-fuzz/corpus"s);
+    auto mutationsArg = Cli::option<usize>('m', "mutations"s, "Mutated inputs to run per seed"s, 0);
+    auto seedArg = Cli::option<usize>('s', "seed"s, "Seed of the mutation generator"s, 1);
+    auto benchArg = Cli::flag('b', "bench"s, "Report the parsing throughput of every seed in nodes/s"s);
+    auto iterationsArg = Cli::option<usize>('n', "iterations"s, "Minimum iterations per measurement"s, 100);
+
+    Cli::Command cmd{
+        "dtb-fuzz"s,
+        "Fuzz the device tree parser from a seed corpus"s,
+        {
+            Cli::Section{"Input"s, {corpusArg}},
+            Cli::Section{"Fuzzing"s, {mutationsArg, seedArg}},
+            Cli::Section{"Measurement"s, {benchArg, iterationsArg}},
+        }
+    };
+
+    co_try$(cmd.exec(env));
+    if (not cmd)
+        co_return Ok();
+
+    if (not corpusArg.value())
+        co_return Error::invalidInput("no corpus provided");
+
+    auto corpus = co_try$(loadCorpus(env, corpusArg.value()));
+
+    usize nodes = 0;
+    for (auto const& seed : corpus)
+        nodes += fuzz(Bytes{seed.bytes.buf(), seed.bytes.len()});
+    Sys::println("Replayed {} seed(s), {} nodes", corpus.len(), nodes);
+
+    if (usize mutations = mutationsArg.value()) {
+        Rng rng{max<u64>(seedArg.value(), 1)};
+        Vec<u8> input;
+        for (auto const& seed : corpus) {
+            for (usize i = 0; i < mutations; i++) {
+                mutate(rng, Bytes{seed.bytes.buf(), seed.bytes.len()}, input);
+                fuzz(Bytes{input.buf(), input.len()});
+            }
+        }
+        Sys::println("Ran {} mutated input(s)", corpus.len() * mutations);
+    }
+
+    if (benchArg.value()) {
+        Sys::println("Throughput:");
+        for (auto const& seed : corpus)
+            bench(seed, max(iterationsArg.value(), 1uz));
+    }
+
+    co_return Ok();
+}
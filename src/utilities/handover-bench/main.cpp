@@ -0,0 +1,156 @@
+import Karm.Cli;
+
+#include <karm/entry>
+#include <vaerk-handover/builder.h>
+
+using namespace Karm::Literals;
+
+static constexpr usize PAGE_SIZE = 4096;
+static constexpr usize PAYLOAD_SIZE = 64 * 1024;
+
+// MARK: Memory maps -----------------------------------------------------------
+
+struct Rng {
+    u64 _state;
+
+    u64 next() {
+        _state ^= _state << 13;
+        _state ^= _state >> 7;
+        _state ^= _state << 17;
+        return _state;
+    }
+
+    usize below(usize n) {
+        return n ? next() % n : 0;
+    }
+};
+
+// A memory map shaped like the ones OVMF hands out after a few boots:
+// contiguous descriptors of mostly usable memory, with runtime, ACPI and
+// MMIO holes in between. Usable descriptors become FREE records, the rest
+// RESERVED, like the loader does.
+Vec<Handover::Record> fragmentedMap(usize len, Rng& rng) {
+    Vec<Handover::Record> records;
+    u64 addr = 0x1000;
+    for (usize i = 0; i < len; i++) {
+        bool usable = rng.below(5) != 0;
+        u64 size = (1 + rng.below(usable ? 512 : 16)) * PAGE_SIZE;
+        records.pushBack({
+            .tag = usable ? Handover::Tag::FREE : Handover::Tag::RESERVED,
+            .start = addr,
+            .size = size,
+        });
+        addr += size;
+
+        // Holes between descriptors are not described at all.
+        if (rng.below(8) == 0)
+            addr += (1 + rng.below(64)) * PAGE_SIZE;
+    }
+    return records;
+}
+
+void shuffle(Vec<Handover::Record>& records, Rng& rng) {
+    for (usize i = records.len(); i > 1; i--)
+        std::swap(records[i - 1], records[rng.below(i)]);
+}
+
+// MARK: Benchmarks ------------------------------------------------------------
+
+static volatile usize _sink = 0;
+
+// Sys::instant() has a microsecond resolution, runs are doubled until they
+// last long enough for it not to matter.
+static constexpr u64 MIN_USECS = 10000;
+
+template <typename F>
+void bench(Str name, usize iterations, F&& f) {
+    while (true) {
+        auto start = Sys::instant();
+        for (usize i = 0; i < iterations; i++)
+            _sink = _sink + f();
+        u64 usecs = (Sys::instant() - start).toUSecs();
+        if (usecs >= MIN_USECS) {
+            Sys::println("  {}: {} us/payload", name, f64(usecs) / iterations);
+            return;
+        }
+        iterations *= 2;
+    }
+}
+
+Res<> _sameLayout(Handover::Payload const& a, Handover::Payload const& b) {
+    if (a.len != b.len)
+        return Error::other("add() and addBatch() disagree on the record count");
+    for (usize i = 0; i < a.len; i++) {
+        auto const& x = a.records[i];
+        auto const& y = b.records[i];
+        if (x.tag != y.tag or x.flags != y.flags or x.start != y.start or x.size != y.size)
+            return Error::other("add() and addBatch() disagree on the layout");
+    }
+    return Ok();
+}
+
+Res<> run(Str name, Slice<Handover::Record> map, usize iterations) {
+    Vec<u8> one, batch;
+    one.resize(PAYLOAD_SIZE);
+    batch.resize(PAYLOAD_SIZE);
+
+    auto addOne = [&] {
+        Handover::Builder builder{MutSlice<u8>{one.buf(), one.len()}};
+        for (auto const& record : map)
+            builder.add(record);
+        return builder.finalize().len;
+    };
+
+    auto addBatch = [&] {
+        Handover::Builder builder{MutSlice<u8>{batch.buf(), batch.len()}};
+        builder.addBatch(map);
+        return builder.finalize().len;
+    };
+
+    usize len = addOne();
+    addBatch();
+    try$(_sameLayout(
+        *reinterpret_cast<Handover::Payload const*>(one.buf()),
+        *reinterpret_cast<Handover::Payload const*>(batch.buf())
+    ));
+
+    Sys::println("{}: {} entries -> {} records", name, map.len(), len);
+    bench("add()"s, iterations, addOne);
+    bench("addBatch()"s, iterations, addBatch);
+    return Ok();
+}
+
+Async::Task<> entryPointAsync(Sys::Env& env, Async::CancellationToken) {
+    auto entriesArg = Cli::option<usize>('e', "entries"s, "Descriptors in the generated memory map"s, 500);
+    auto seedArg = Cli::option<usize>('s', "seed"s, "Seed of the memory map generator"s, 1);
+    auto iterationsArg = Cli::option<usize>('n', "iterations"s, "Minimum iterations per measurement"s, 100);
+
+    Cli::Command cmd{
+        "handover-bench"s,
+        "Measure building handover payloads from large memory maps"s,
+        {
+            Cli::Section{"Memory map"s, {entriesArg, seedArg}},
+            Cli::Section{"Measurement"s, {iterationsArg}},
+        }
+    };
+
+    co_try$(cmd.exec(env));
+    if (not cmd)
+        co_return Ok();
+
+    // Both strategies may stage up to two slots per record.
+    usize entries = entriesArg.value();
+    if (2 * entries * sizeof(Handover::Record) + sizeof(Handover::Payload) > PAYLOAD_SIZE)
+        co_return Error::invalidInput("too many entries for the payload");
+
+    usize iterations = max(iterationsArg.value(), 1uz);
+    Rng rng{max<u64>(seedArg.value(), 1)};
+
+    auto map = fragmentedMap(entries, rng);
+    co_try$(run("sorted"s, map, iterations));
+
+    shuffle(map, rng);
+    co_try$(run("shuffled"s, map, iterations));
+
+    co_return Ok();
+}
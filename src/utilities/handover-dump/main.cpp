@@ -1,13 +1,65 @@
 import Karm.Dl.Elf;
+import Karm.Cli;
 
 #include <karm/entry>
+#include <vaerk-boot/image.h>
+#include <vaerk-handover/image.h>
 #include <vaerk-handover/spec.h>
 
+using namespace Karm::Literals;
+
+static char const* _pixelFormatName(u64 format) {
+    switch ((Handover::PixelFormat)format) {
+    case Handover::PixelFormat::RGBX8888:
+        return "RGBX8888";
+    case Handover::PixelFormat::BGRX8888:
+        return "BGRX8888";
+    }
+    return "UNKNOWN";
+}
+
+void dumpRequests(Slice<Handover::Request> requests) {
+    Sys::println("Requests:");
+    for (auto const& request : requests) {
+        if (request.tag == Handover::Tag::STACK)
+            Sys::println(" - {} ({} bytes)", request.name(), request.more);
+        else if (request.tag == Handover::Tag::FB)
+            Sys::println(" - {} ({})", request.name(), _pixelFormatName(request.more));
+        else
+            Sys::println(" - {}", request.name());
+    }
+}
+
+// MARK: Manifest --------------------------------------------------------------
+
+void dumpSegments(Slice<Handover::Segment> segments) {
+    Sys::println("Segments:");
+    for (auto const& s : segments)
+        Sys::println(" - {:016x} file:{:x} mem:{:x} bss:{:x} align:{:x} flags:{:x}", s.vaddr, s.filesz, s.memsz, s.bss(), s.align, s.flags);
+}
+
 Async::Task<> entryPointAsync(Sys::Env& env, Async::CancellationToken) {
-    if (env.argsLen() == 0)
-        co_return Error::invalidInput("Usage: handover-dump <elf-file>");
+    auto inputArg = Cli::operand<Str>("elf-file"s, "Path to the kernel ELF executable"s);
+    auto checkArg = Cli::flag('c', "check"s, "Validate the request section and the load layout"s);
+    auto manifestArg = Cli::option<Str>('m', "manifest"s, "Write the precomputed load layout to a file"s, ""s);
 
-    auto url = Ref::parseUrlOrPath(env[0], env.cwd());
+    Cli::Command cmd{
+        "handover-dump"s,
+        "Dump handover information from a kernel ELF executable"s,
+        {
+            Cli::Section{"Input"s, {inputArg}},
+            Cli::Section{"Output"s, {checkArg, manifestArg}},
+        }
+    };
+
+    co_try$(cmd.exec(env));
+    if (not cmd)
+        co_return Ok();
+
+    if (not inputArg.value())
+        co_return Error::invalidInput("no elf file provided");
+
+    auto url = Ref::parseUrlOrPath(inputArg.value(), env.cwd());
     auto file = co_try$(Sys::File::open(url));
     auto mem = co_try$(Sys::mmap(file, {.options = Sys::MmapOption::READ}));
     auto elf = Elf::ElfObject<Elf::Elf64LeAbi>{mem.bytes()};
@@ -15,14 +67,31 @@ Async::Task<> entryPointAsync(Sys::Env& env, Async::CancellationToken) {
     if (not elf.validate())
         co_return Error::invalidData("kernel is not a valid ELF executable");
 
-    auto requests =
+    auto section =
         co_try$(elf.section(Handover::REQUEST_SECTION))
             .data.cast<Handover::Request>();
 
-    Sys::println("Requests:");
-    for (auto const& request : requests)
-        Sys::println(" - {}", request.name());
-    Sys::println("Kernel is valid");
+    if (not checkArg.value() and not manifestArg.value()) {
+        dumpRequests(section);
+        Sys::println("Kernel is valid");
+        co_return Ok();
+    }
 
+    auto manifest = co_try$(Boot::buildImage(elf));
+    auto const& image = *reinterpret_cast<Handover::Image const*>(manifest.buf());
+    co_try$(image.validate(manifest.len(), mem.bytes().len()));
+
+    dumpRequests(co_try$(image.requests(manifest.len())));
+    dumpSegments({image.segments, image.len});
+    Sys::println("Image: {:016x}-{:016x} entry:{:016x}", image.start, image.start + image.size, image.entry);
+
+    if (manifestArg.value()) {
+        auto outUrl = Ref::parseUrlOrPath(manifestArg.value(), env.cwd());
+        auto out = co_try$(Sys::File::create(outUrl));
+        co_try$(out.write(manifest));
+        Sys::println("Manifest written ({} bytes)", manifest.len());
+    }
+
+    Sys::println("Kernel is valid");
     co_return Ok();
 }
@@ -0,0 +1,116 @@
+#include <karm/entry>
+
+import Vaerk.Lz4;
+import Karm.Cli;
+
+using namespace Karm;
+using namespace Karm::Literals;
+
+using namespace Vaerk;
+
+// Reopen and read the whole file into `out` on every call, so that the
+// measurements include going through the file system. Repeated runs are
+// served from the page cache, like a loader reading from a warm disk cache.
+static Res<> _read(Ref::Url const& url, MutBytes out) {
+    auto file = try$(Sys::File::open(url));
+    usize done = 0;
+    while (done < out.len()) {
+        auto n = try$(file.read(sub(out, done, out.len())));
+        if (n == 0)
+            return Error::invalidData("file shrank while reading");
+        done += n;
+    }
+    return Ok();
+}
+
+// Sys::instant() has a microsecond resolution, runs are doubled until they
+// last long enough for it not to matter.
+static constexpr u64 MIN_USECS = 10000;
+
+template <typename F>
+Res<> bench(Str name, usize iterations, usize bytes, F&& f) {
+    while (true) {
+        auto start = Sys::instant();
+        for (usize i = 0; i < iterations; i++)
+            try$(f());
+        u64 usecs = (Sys::instant() - start).toUSecs();
+        if (usecs >= MIN_USECS) {
+            f64 nsecs = usecs * 1000.0 / iterations;
+            Sys::println("  {}: {} ns/op, {} MiB/s", name, nsecs, bytes / nsecs * 1000000000 / (1024 * 1024));
+            return Ok();
+        }
+        iterations *= 2;
+    }
+}
+
+Async::Task<> entryPointAsync(Sys::Env& env, Async::CancellationToken) {
+    auto inputArg = Cli::operand<Str>("input"s, "LZ4 frame to measure, with its content size set"s);
+    auto rawArg = Cli::option<Str>('r', "raw"s, "Uncompressed file to compare against"s, ""s);
+    auto iterationsArg = Cli::option<usize>('n', "iterations"s, "Minimum iterations per measurement"s, 10);
+
+    Cli::Command cmd{
+        "lz4-bench"s,
+        "Compare reading a raw blob against reading and decompressing an LZ4 one"s,
+        {
+            Cli::Section{"Input"s, {inputArg, rawArg}},
+            Cli::Section{"Measurement"s, {iterationsArg}},
+        }
+    };
+
+    co_try$(cmd.exec(env));
+    if (not cmd)
+        co_return Ok();
+
+    if (not inputArg.value())
+        co_return Error::invalidInput("no lz4 file provided");
+
+    usize iterations = max(iterationsArg.value(), 1uz);
+
+    auto url = Ref::parseUrlOrPath(inputArg.value(), env.cwd());
+    auto file = co_try$(Sys::File::open(url));
+    auto map = co_try$(Sys::mmap(file));
+    auto compressed = map.bytes();
+
+    auto frame = co_try$(Lz4::peek(compressed));
+    if (not frame.contentSize)
+        co_return Error::invalidInput("lz4 frame has no content size, compress with --content-size");
+    usize contentSize = *frame.contentSize;
+
+    Sys::println("{}: {} bytes -> {} bytes", inputArg.value(), compressed.len(), contentSize);
+
+    Vec<u8> out;
+    out.resize(contentSize);
+    Vec<u8> staging;
+    staging.resize(compressed.len());
+
+    co_try$(bench("read + decompress", iterations, contentSize, [&] -> Res<> {
+        try$(_read(url, MutBytes{staging.buf(), staging.len()}));
+        try$(Lz4::decompress(Bytes{staging.buf(), staging.len()}, MutBytes{out.buf(), out.len()}));
+        return Ok();
+    }));
+
+    // Read the frame at the end of the destination and decompress over it.
+    usize inPlaceSize = max(contentSize, compressed.len()) + Lz4::inPlaceMargin(compressed.len());
+    Vec<u8> inPlace;
+    inPlace.resize(inPlaceSize);
+    co_try$(bench("read + decompress in place", iterations, contentSize, [&] -> Res<> {
+        u8* src = inPlace.buf() + inPlaceSize - compressed.len();
+        try$(_read(url, MutBytes{src, compressed.len()}));
+        try$(Lz4::decompress(Bytes{src, compressed.len()}, MutBytes{inPlace.buf(), inPlaceSize}));
+        return Ok();
+    }));
+
+    if (rawArg.value()) {
+        auto rawUrl = Ref::parseUrlOrPath(rawArg.value(), env.cwd());
+        auto rawFile = co_try$(Sys::File::open(rawUrl));
+        auto rawMap = co_try$(Sys::mmap(rawFile));
+        Vec<u8> rawOut;
+        rawOut.resize(rawMap.bytes().len());
+
+        co_try$(bench("read raw", iterations, rawOut.len(), [&] -> Res<> {
+            return _read(rawUrl, MutBytes{rawOut.buf(), rawOut.len()});
+        }));
+    }
+
+    co_return Ok();
+}
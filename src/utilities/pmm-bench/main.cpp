@@ -0,0 +1,203 @@
+#include <karm/entry>
+#include <thread>
+
+import Vaerk.Pmm;
+import Karm.Cli;
+
+using namespace Karm;
+using namespace Karm::Literals;
+
+using namespace Vaerk;
+
+// The allocators never touch the memory they manage, any base will do.
+static constexpr usize BASE = 0x1'0000'0000;
+
+// MARK: Benchmarks ------------------------------------------------------------
+
+static volatile usize _sink = 0;
+
+// Sys::instant() has a microsecond resolution, runs are doubled until they
+// last long enough for it not to matter.
+static constexpr u64 MIN_USECS = 10000;
+
+template <typename F>
+void bench(Str name, usize iterations, usize opsPerIteration, F&& f) {
+    while (true) {
+        auto start = Sys::instant();
+        for (usize i = 0; i < iterations; i++)
+            _sink = _sink + f();
+        u64 usecs = (Sys::instant() - start).toUSecs();
+        if (usecs >= MIN_USECS) {
+            Sys::println("  {}: {} ns/op", name, usecs * 1000.0 / (iterations * opsPerIteration));
+            return;
+        }
+        iterations *= 2;
+    }
+}
+
+struct Fixture {
+    Vec<Pmm::Buddy::Frame> frames;
+    Pmm::Buddy buddy;
+
+    Fixture(usize pages)
+        : frames(_frames(pages)),
+          buddy(BASE, MutSlice<Pmm::Buddy::Frame>{frames.buf(), frames.len()}) {
+        buddy.release(buddy.span());
+    }
+
+    static Vec<Pmm::Buddy::Frame> _frames(usize pages) {
+        Vec<Pmm::Buddy::Frame> frames;
+        frames.resize(pages);
+        return frames;
+    }
+};
+
+Res<> run(usize pages, usize iterations) {
+    Fixture f{pages};
+    Sys::println("  {} pages, metadata {}", pages, DataSize{Pmm::Buddy::metadataSize(f.buddy.span())});
+
+    // A single page out of a fully coalesced span, every order is split on
+    // the way down and merged back on free.
+    bench("alloc + free order 0"s, iterations, 1, [&] {
+        auto page = f.buddy.alloc(0).unwrap();
+        f.buddy.free(page, 0);
+        return page;
+    });
+
+    bench("alloc + free order 9"s, iterations, 1, [&] {
+        auto block = f.buddy.alloc(9).unwrap();
+        f.buddy.free(block, 9);
+        return block;
+    });
+
+    // Take every page, then give them all back in the same order.
+    Vec<usize> taken;
+    taken.resize(pages);
+    bench("fill + drain"s, 1, pages, [&] {
+        for (usize i = 0; i < pages; i++)
+            taken[i] = f.buddy.alloc(0).unwrap();
+        for (usize i = 0; i < pages; i++)
+            f.buddy.free(taken[i], 0);
+        return f.buddy.freePages();
+    });
+
+    // Keep every other page, the worst case for the free lists.
+    usize kept = 0;
+    for (usize i = 0; i < pages; i++)
+        taken[i] = f.buddy.alloc(0).unwrap();
+    for (usize i = 0; i < pages; i += 2, kept++)
+        f.buddy.free(taken[i], 0);
+
+    bench("alloc + free fragmented"s, iterations, 1, [&] {
+        auto page = f.buddy.alloc(0).unwrap();
+        f.buddy.free(page, 0);
+        return page;
+    });
+
+    if (f.buddy.freePages() != kept)
+        return Error::other("free page count drifted");
+
+    return Ok();
+}
+
+// MARK: Contention ------------------------------------------------------------
+
+// Host threads stand in for CPUs, they all allocate and free bursts of
+// single pages, either straight from the pool or through their own cache.
+static constexpr usize BURST = 64;
+
+template <typename Alloc, typename Free>
+void _churn(usize ops, Alloc&& alloc, Free&& free) {
+    Array<usize, BURST> held;
+    for (usize done = 0; done < ops; done += BURST) {
+        for (auto& page : held)
+            page = alloc();
+        for (auto page : held)
+            free(page);
+    }
+}
+
+template <typename F>
+void contend(Str name, usize threads, usize ops, F&& perThread) {
+    Vec<std::thread> workers;
+    auto start = Sys::instant();
+    for (usize i = 0; i < threads; i++)
+        workers.pushBack(std::thread{[&] {
+            perThread(ops);
+        }});
+    for (auto& worker : workers)
+        worker.join();
+    u64 usecs = max((Sys::instant() - start).toUSecs(), u64(1));
+    Sys::println("  {}: {} ns/op, {} Mop/s", name, usecs * 1000.0 / ops, f64(threads * ops) / usecs);
+}
+
+Res<> runContended(usize pages, usize threads, usize ops) {
+    Fixture f{pages};
+    Pmm::Pool pool{f.buddy};
+    ops = max(ops / BURST, 1uz) * BURST;
+    Sys::println("  {} thread(s), {} ops each", threads, ops);
+
+    contend("pool"s, threads, ops, [&](usize ops) {
+        _churn(ops, [&] {
+            return pool.alloc(0).unwrap();
+        }, [&](usize page) {
+            pool.free(page, 0);
+        });
+    });
+
+    Pmm::PageCache::Stats total;
+    Lock statsLock;
+    contend("page cache"s, threads, ops, [&](usize ops) {
+        Pmm::PageCache cache{pool};
+        _churn(ops, [&] {
+            return cache.alloc().unwrap();
+        }, [&](usize page) {
+            cache.free(page);
+        });
+        cache.flush();
+
+        LockScope scope{statsLock};
+        total.hits += cache.stats().hits;
+        total.misses += cache.stats().misses;
+        total.refills += cache.stats().refills;
+        total.drains += cache.stats().drains;
+    });
+    Sys::println("  page cache hit rate: {}%, {} refills, {} drains", total.hitRate() * 100, total.refills, total.drains);
+
+    if (pool.freePages() != pages)
+        return Error::other("free page count drifted");
+
+    return Ok();
+}
+
+Async::Task<> entryPointAsync(Sys::Env& env, Async::CancellationToken) {
+    auto sizeArg = Cli::option<usize>('s', "size"s, "Size of the managed span in MiB"s, 1024);
+    auto iterationsArg = Cli::option<usize>('n', "iterations"s, "Minimum iterations per measurement"s, 1000);
+    auto threadsArg = Cli::option<usize>('t', "threads"s, "Threads contending on the pool, none to skip"s, 4);
+    auto opsArg = Cli::option<usize>('o', "ops"s, "Allocations per thread when contending"s, 1000000);
+
+    Cli::Command cmd{
+        "pmm-bench"s,
+        "Measure the physical memory allocators"s,
+        {
+            Cli::Section{"Measurement"s, {sizeArg, iterationsArg}},
+            Cli::Section{"Contention"s, {threadsArg, opsArg}},
+        }
+    };
+
+    co_try$(cmd.exec(env));
+    if (not cmd)
+        co_return Ok();
+
+    usize pages = max(sizeArg.value(), 1uz) * 1024 * 1024 / Pmm::PAGE_SIZE;
+
+    Sys::println("buddy:");
+    co_try$(run(pages, max(iterationsArg.value(), 1uz)));
+
+    if (threadsArg.value()) {
+        Sys::println("contention:");
+        co_try$(runContended(pages, threadsArg.value(), opsArg.value()));
+    }
+
+    co_return Ok();
+}
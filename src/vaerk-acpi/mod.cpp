@@ -1,3 +1,9 @@
+module;
+
+#if defined(__SSE2__) or defined(__AVX2__)
+#    include <immintrin.h>
+#endif
+
 export module Vaerk.Acpi;
 
 import Karm.Core;
@@ -7,6 +13,56 @@ using namespace Karm;
 
 namespace Vaerk::Acpi {
 
+// MARK: Checksum --------------------------------------------------------------
+
+// The sum of all the bytes of a table, including its checksum field, must
+// be zero.
+export u8 checksumScalar(u8 const* buf, usize len) {
+    u8 sum = 0;
+    for (usize i = 0; i < len; i++)
+        sum += buf[i];
+    return sum;
+}
+
+// Only the low byte of the sum matters, so bytes can be summed in wider
+// lanes and folded at the end.
+export u8 checksum(u8 const* buf, usize len) {
+    usize i = 0;
+    u64 sum = 0;
+
+#if defined(__AVX2__)
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(buf + i));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, _mm256_setzero_si256()));
+    }
+    sum += _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+           _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+#elif defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(buf + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, _mm_setzero_si128()));
+    }
+    sum += _mm_cvtsi128_si64(acc) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+#else
+    // Sum pairs of bytes in 16-bit lanes, folding before they can overflow.
+    while (i + 8 <= len) {
+        u64 lanes = 0;
+        for (usize n = 0; n < 128 and i + 8 <= len; n++, i += 8) {
+            u64 word;
+            __builtin_memcpy(&word, buf + i, sizeof(word));
+            lanes += word & 0x00ff00ff00ff00ff;
+            lanes += (word >> 8) & 0x00ff00ff00ff00ff;
+        }
+        sum += (lanes & 0xffff) + ((lanes >> 16) & 0xffff) +
+               ((lanes >> 32) & 0xffff) + (lanes >> 48);
+    }
+#endif
+
+    return u8(sum) + checksumScalar(buf + i, len - i);
+}
+
 // MARK: RSDP (Root System Description Pointer) --------------------------------
 
 export struct [[gnu::packed]] Rsdp {
@@ -31,6 +87,22 @@ export struct [[gnu::packed]] Rsdp {
     bool isAcpi2() const {
         return revision >= 2;
     }
+
+    // Checks the signature, the ACPI 1.0 checksum over the first 20 bytes,
+    // and for ACPI 2.0+ the extended checksum over the whole structure.
+    bool verify() const {
+        if (not isValid())
+            return false;
+
+        auto const* bytes = reinterpret_cast<u8 const*>(this);
+        if (Acpi::checksum(bytes, offsetof(Rsdp, length)) != 0)
+            return false;
+
+        if (not isAcpi2())
+            return true;
+
+        return length >= sizeof(Rsdp) and Acpi::checksum(bytes, length) == 0;
+    }
 };
 
 using Signature = Array<char, 4>;
@@ -50,6 +122,11 @@ export struct [[gnu::packed]] Sdth {
     T const* as() const {
         return reinterpret_cast<T const*>(this);
     }
+
+    bool isValid() const {
+        return len >= sizeof(Sdth) and
+               Acpi::checksum(reinterpret_cast<u8 const*>(this), len) == 0;
+    }
 };
 
 export struct [[gnu::packed]] Rsdt : Sdth {
@@ -70,27 +147,91 @@ export struct [[gnu::packed]] Xsdt : Sdth {
     }
 };
 
+// MARK: Subtables -------------------------------------------------------------
+
+// The type and length header shared by the records of MADT and SRAT.
+export struct [[gnu::packed]] Subtable {
+    u8 type;
+    u8 len;
+
+    // A typed view of the record, or null if it's of another type or
+    // too short to hold T.
+    template <typename T>
+    T const* as() const {
+        if (type != u8(T::TYPE) or len < sizeof(T))
+            return nullptr;
+        return static_cast<T const*>(this);
+    }
+};
+
+// Walks the records of a table without reading past its end, a record
+// shorter than its header ends the walk.
+export struct SubtableIter {
+    u8 const* _curr;
+    u8 const* _end;
+
+    static SubtableIter begin(Sdth const* table, usize header) {
+        auto const* base = reinterpret_cast<u8 const*>(table);
+        SubtableIter it{base + header, base + max<usize>(table->len, header)};
+        it._check();
+        return it;
+    }
+
+    static SubtableIter end(Sdth const* table, usize header) {
+        auto const* end = reinterpret_cast<u8 const*>(table) + max<usize>(table->len, header);
+        return {end, end};
+    }
+
+    Subtable const& operator*() const {
+        return *reinterpret_cast<Subtable const*>(_curr);
+    }
+
+    SubtableIter& operator++() {
+        _curr += (**this).len;
+        _check();
+        return *this;
+    }
+
+    bool operator==(SubtableIter const& other) const {
+        return _curr == other._curr;
+    }
+
+    void _check() {
+        if (_end - _curr < isize(sizeof(Subtable)) or
+            (**this).len < sizeof(Subtable) or
+            (**this).len > _end - _curr)
+            _curr = _end;
+    }
+};
+
+// MARK: MADT (Multiple APIC Description Table) --------------------------------
+
 export struct [[gnu::packed]] Madt : Sdth {
+    static constexpr Signature SIGNATURE = {'A', 'P', 'I', 'C'};
+
     enum struct Type {
         LAPIC = 0,
         IOAPIC = 1,
         ISO = 2,
         NMI = 4,
-        LAPIC_OVERRIDE = 5
+        LAPIC_OVERRIDE = 5,
+        X2APIC = 9,
+        GICC = 11,
     };
 
-    struct [[gnu::packed]] Record {
-        u8 type;
-        u8 len;
-    };
+    using Record = Subtable;
 
     struct [[gnu::packed]] LapicRecord : Record {
+        static constexpr Type TYPE = Type::LAPIC;
+
         u8 processorId;
         u8 id;
         u32 flags;
     };
 
     struct [[gnu::packed]] IoapicRecord : Record {
+        static constexpr Type TYPE = Type::IOAPIC;
+
         u8 id;
         u8 reserved;
         u32 address;
@@ -98,18 +239,415 @@ export struct [[gnu::packed]] Madt : Sdth {
     };
 
     struct [[gnu::packed]] IsoRecord : Record {
+        static constexpr Type TYPE = Type::ISO;
+
         u8 bus;
         u8 irq;
         u32 gsi;
         u16 flags;
     };
 
+    struct [[gnu::packed]] LapicOverrideRecord : Record {
+        static constexpr Type TYPE = Type::LAPIC_OVERRIDE;
+
+        u16 reserved;
+        u64 address;
+    };
+
+    struct [[gnu::packed]] X2apicRecord : Record {
+        static constexpr Type TYPE = Type::X2APIC;
+
+        u16 reserved;
+        u32 id;
+        u32 flags;
+        u32 processorUid;
+    };
+
+    struct [[gnu::packed]] GiccRecord : Record {
+        static constexpr Type TYPE = Type::GICC;
+
+        u16 reserved;
+        u32 cpuInterface;
+        u32 processorUid;
+        u32 flags;
+        u32 parkingVersion;
+        u32 performanceGsiv;
+        u64 parkedAddress;
+        u64 address;
+        u64 gicv;
+        u64 gich;
+        u32 vgicMaintenanceGsiv;
+        u64 gicrAddress;
+        u64 mpidr;
+    };
+
+    // Flags of LAPIC, x2APIC and GICC records
+    static constexpr u32 CPU_ENABLED = 1 << 0;
+    static constexpr u32 CPU_ONLINE_CAPABLE = 1 << 1; // LAPIC and x2APIC only
+
     u32 lapic;
     u32 flags;
 
     Record records[];
+
+    SubtableIter begin() const {
+        return SubtableIter::begin(this, sizeof(Madt));
+    }
+
+    SubtableIter end() const {
+        return SubtableIter::end(this, sizeof(Madt));
+    }
+};
+
+// MARK: CPU Topology ----------------------------------------------------------
+
+// What SMP and interrupt bring-up need from the MADT, gathered in a
+// single pass. Storage is inline, entries past the capacity are counted in
+// `dropped`.
+export struct CpuTopology {
+    static constexpr usize MAX_CPUS = 1024;
+    static constexpr usize MAX_IOAPICS = 64;
+    static constexpr usize MAX_OVERRIDES = 64;
+
+    struct Cpu {
+        u64 id; // APIC ID, or processor UID on GIC systems like in the SRAT
+        u32 uid;
+        bool enabled; // Otherwise only online capable
+        u64 mpidr;    // GIC systems only
+    };
+
+    struct Ioapic {
+        u32 id;
+        u32 address;
+        u32 gsiBase;
+    };
+
+    struct Override {
+        u8 bus;
+        u8 irq;
+        u32 gsi;
+        u16 flags;
+    };
+
+    u64 lapicAddress = 0;
+    Array<Cpu, MAX_CPUS> cpus;
+    usize cpusLen = 0;
+    Array<Ioapic, MAX_IOAPICS> ioapics;
+    usize ioapicsLen = 0;
+    Array<Override, MAX_OVERRIDES> overrides;
+    usize overridesLen = 0;
+    usize dropped = 0;
+
+    template <typename T, usize N>
+    void _push(Array<T, N>& arr, usize& len, T value) {
+        if (len == N) {
+            dropped++;
+            return;
+        }
+        arr[len++] = value;
+    }
+
+    void _cpu(u64 id, u32 uid, u32 flags, u64 mpidr = 0) {
+        if (not(flags & (Madt::CPU_ENABLED | Madt::CPU_ONLINE_CAPABLE)))
+            return;
+        _push(cpus, cpusLen, {id, uid, bool(flags & Madt::CPU_ENABLED), mpidr});
+    }
+
+    // Load the topology in place, it's too large to comfortably return on
+    // an early boot stack.
+    void load(Madt const& madt) {
+        cpusLen = ioapicsLen = overridesLen = dropped = 0;
+        lapicAddress = madt.lapic;
+
+        for (auto const& record : madt) {
+            if (auto* lapic = record.as<Madt::LapicRecord>())
+                _cpu(lapic->id, lapic->processorId, lapic->flags);
+            else if (auto* x2apic = record.as<Madt::X2apicRecord>())
+                _cpu(x2apic->id, x2apic->processorUid, x2apic->flags);
+            else if (auto* gicc = record.as<Madt::GiccRecord>())
+                _cpu(gicc->processorUid, gicc->processorUid, gicc->flags & Madt::CPU_ENABLED, gicc->mpidr);
+            else if (auto* ioapic = record.as<Madt::IoapicRecord>())
+                _push(ioapics, ioapicsLen, {ioapic->id, ioapic->address, ioapic->interruptBase});
+            else if (auto* iso = record.as<Madt::IsoRecord>())
+                _push(overrides, overridesLen, {iso->bus, iso->irq, iso->gsi, iso->flags});
+            else if (auto* lapicOverride = record.as<Madt::LapicOverrideRecord>())
+                lapicAddress = lapicOverride->address;
+        }
+    }
+
+    Slice<Cpu> cpuList() const {
+        return {cpus.buf(), cpusLen};
+    }
+
+    Slice<Ioapic> ioapicList() const {
+        return {ioapics.buf(), ioapicsLen};
+    }
+
+    Slice<Override> overrideList() const {
+        return {overrides.buf(), overridesLen};
+    }
+
+    // The I/O APIC serving a GSI is the one with the highest base below it,
+    // its upper bound is only known from its version register.
+    Ioapic const* ioapicFor(u32 gsi) const {
+        Ioapic const* best = nullptr;
+        for (auto const& ioapic : ioapicList())
+            if (ioapic.gsiBase <= gsi and (not best or ioapic.gsiBase > best->gsiBase))
+                best = &ioapic;
+        return best;
+    }
+
+    // ISA IRQs are identity mapped unless overridden.
+    u32 gsiFor(u8 irq) const {
+        for (auto const& iso : overrideList())
+            if (iso.bus == 0 and iso.irq == irq)
+                return iso.gsi;
+        return irq;
+    }
 };
 
+// MARK: SRAT (System Resource Affinity Table) ---------------------------------
+
+export struct [[gnu::packed]] Srat : Sdth {
+    static constexpr Signature SIGNATURE = {'S', 'R', 'A', 'T'};
+
+    enum struct Type {
+        LAPIC = 0,
+        MEMORY = 1,
+        X2APIC = 2,
+        GICC = 3,
+    };
+
+    // Flags of all affinity records
+    static constexpr u32 ENABLED = 1 << 0;
+    static constexpr u32 HOT_PLUGGABLE = 1 << 1; // Memory only
+
+    struct [[gnu::packed]] LapicRecord : Subtable {
+        static constexpr Type TYPE = Type::LAPIC;
+
+        u8 domainLow;
+        u8 apicId;
+        u32 flags;
+        u8 sapicEid;
+        Array<u8, 3> domainHigh;
+        u32 clockDomain;
+
+        u32 domain() const {
+            return domainLow | (domainHigh[0] << 8) | (domainHigh[1] << 16) | (u32(domainHigh[2]) << 24);
+        }
+    };
+
+    struct [[gnu::packed]] MemoryRecord : Subtable {
+        static constexpr Type TYPE = Type::MEMORY;
+
+        u32 domain;
+        u16 reserved1;
+        u64 base;
+        u64 length;
+        u32 reserved2;
+        u32 flags;
+        u64 reserved3;
+    };
+
+    struct [[gnu::packed]] X2apicRecord : Subtable {
+        static constexpr Type TYPE = Type::X2APIC;
+
+        u16 reserved1;
+        u32 domain;
+        u32 x2apicId;
+        u32 flags;
+        u32 clockDomain;
+        u32 reserved2;
+    };
+
+    struct [[gnu::packed]] GiccRecord : Subtable {
+        static constexpr Type TYPE = Type::GICC;
+
+        u32 domain;
+        u32 processorUid;
+        u32 flags;
+        u32 clockDomain;
+    };
+
+    u32 reserved1;
+    u64 reserved2;
+
+    SubtableIter begin() const {
+        return SubtableIter::begin(this, sizeof(Srat));
+    }
+
+    SubtableIter end() const {
+        return SubtableIter::end(this, sizeof(Srat));
+    }
+};
+
+// MARK: SLIT (System Locality Information Table) ------------------------------
+
+export struct [[gnu::packed]] Slit : Sdth {
+    static constexpr Signature SIGNATURE = {'S', 'L', 'I', 'T'};
+
+    u64 localities;
+    u8 entries[];
+
+    // Number of localities, or zero when the matrix doesn't fit in the
+    // table. Rows are `localities` wide, so a truncated table can't be
+    // read as a smaller matrix.
+    usize count() const {
+        usize room = len > sizeof(Slit) ? len - sizeof(Slit) : 0;
+        if (localities == 0 or localities > room / localities)
+            return 0;
+        return localities;
+    }
+
+    u8 distance(usize from, usize to) const {
+        usize n = count();
+        if (from >= n or to >= n)
+            return 0;
+        return entries[from * n + to];
+    }
+};
+
+// MARK: NUMA Topology ---------------------------------------------------------
+
+// Nodes are the proximity domains of the SRAT renumbered densely in order
+// of appearance, with distances from the SLIT when there is one.
+export struct NumaTopology {
+    static constexpr usize MAX_NODES = 64;
+    static constexpr usize MAX_CPUS = 1024;
+    static constexpr usize MAX_RANGES = 256;
+    static constexpr u8 LOCAL_DISTANCE = 10;
+    static constexpr u8 REMOTE_DISTANCE = 20;
+
+    struct Cpu {
+        u64 id; // APIC ID, or processor UID on GIC systems
+        u32 node;
+    };
+
+    struct Memory {
+        u64 start;
+        u64 size;
+        u32 node;
+        bool hotPluggable;
+
+        u64 end() const {
+            return start + size;
+        }
+    };
+
+    Array<u32, MAX_NODES> domains;
+    usize nodesLen = 0;
+    Array<Cpu, MAX_CPUS> cpus;
+    usize cpusLen = 0;
+    Array<Memory, MAX_RANGES> memory;
+    usize memoryLen = 0;
+    Array<u8, MAX_NODES * MAX_NODES> distances;
+    usize dropped = 0;
+
+    Opt<u32> _node(u32 domain) {
+        for (usize i = 0; i < nodesLen; i++)
+            if (domains[i] == domain)
+                return (u32)i;
+        if (nodesLen == MAX_NODES) {
+            dropped++;
+            return NONE;
+        }
+        domains[nodesLen] = domain;
+        return (u32)nodesLen++;
+    }
+
+    void _cpu(u64 id, u32 domain, u32 flags) {
+        if (not(flags & Srat::ENABLED))
+            return;
+        auto node = _node(domain);
+        if (not node)
+            return;
+        if (cpusLen == MAX_CPUS) {
+            dropped++;
+            return;
+        }
+        cpus[cpusLen++] = {id, *node};
+    }
+
+    void _memory(Srat::MemoryRecord const& record) {
+        if (not(record.flags & Srat::ENABLED) or record.length == 0)
+            return;
+        auto node = _node(record.domain);
+        if (not node)
+            return;
+        if (memoryLen == MAX_RANGES) {
+            dropped++;
+            return;
+        }
+        memory[memoryLen++] = {record.base, record.length, *node, bool(record.flags & Srat::HOT_PLUGGABLE)};
+    }
+
+    // Load the topology in place, like CpuTopology it's too large to be
+    // returned on an early boot stack.
+    void load(Srat const& srat, Slit const* slit = nullptr) {
+        nodesLen = cpusLen = memoryLen = dropped = 0;
+
+        for (auto const& record : srat) {
+            if (auto* lapic = record.as<Srat::LapicRecord>())
+                _cpu(lapic->apicId, lapic->domain(), lapic->flags);
+            else if (auto* x2apic = record.as<Srat::X2apicRecord>())
+                _cpu(x2apic->x2apicId, x2apic->domain, x2apic->flags);
+            else if (auto* gicc = record.as<Srat::GiccRecord>())
+                _cpu(gicc->processorUid, gicc->domain, gicc->flags);
+            else if (auto* mem = record.as<Srat::MemoryRecord>())
+                _memory(*mem);
+        }
+
+        usize localities = slit ? slit->count() : 0;
+        for (usize from = 0; from < nodesLen; from++) {
+            for (usize to = 0; to < nodesLen; to++) {
+                u8 distance = from == to ? LOCAL_DISTANCE : REMOTE_DISTANCE;
+                if (domains[from] < localities and domains[to] < localities)
+                    distance = slit->distance(domains[from], domains[to]);
+                distances[from * MAX_NODES + to] = distance;
+            }
+        }
+    }
+
+    usize nodes() const {
+        return nodesLen;
+    }
+
+    u8 distance(usize from, usize to) const {
+        return distances[from * MAX_NODES + to];
+    }
+
+    Slice<Cpu> cpuList() const {
+        return {cpus.buf(), cpusLen};
+    }
+
+    Slice<Memory> memoryList() const {
+        return {memory.buf(), memoryLen};
+    }
+
+    template <typename F>
+    void cpusOf(usize node, F&& f) const {
+        for (auto const& cpu : cpuList())
+            if (cpu.node == node)
+                f(cpu);
+    }
+
+    template <typename F>
+    void memoryOf(usize node, F&& f) const {
+        for (auto const& range : memoryList())
+            if (range.node == node)
+                f(range);
+    }
+
+    Opt<u32> nodeOf(u64 addr) const {
+        for (auto const& range : memoryList())
+            if (addr >= range.start and addr < range.end())
+                return range.node;
+        return NONE;
+    }
+};
+
+// MARK: MCFG (PCI Express Memory Mapped Configuration) ------------------------
+
 export struct [[gnu::packed]] Mcfg : Sdth {
     static constexpr Signature SIGNATURE = {'M', 'C', 'F', 'G'};
 
@@ -213,32 +751,200 @@ export struct [[gnu::packed]] Hpet : Sdth {
 
 // MARK: Helper functions ------------------------------------------------------
 
-export template <typename Func>
-void iterTables(Rsdp const& rsdp, usize kernelBase, Func&& func) {
+usize _tableCount(Rsdp const& rsdp, usize kernelBase) {
+    if (rsdp.isAcpi2() and rsdp.xsdt != 0)
+        return reinterpret_cast<Xsdt const*>(rsdp.xsdt + kernelBase)->count();
+    return reinterpret_cast<Rsdt const*>(rsdp.rsdt + kernelBase)->count();
+}
+
+Sdth const* _tableAt(Rsdp const& rsdp, usize kernelBase, usize index) {
     if (rsdp.isAcpi2() and rsdp.xsdt != 0) {
         auto* xsdt = reinterpret_cast<Xsdt const*>(rsdp.xsdt + kernelBase);
-        for (usize i = 0; i < xsdt->count(); i++) {
-            auto* sdth = reinterpret_cast<Sdth const*>(xsdt->children[i] + kernelBase);
-            func(sdth);
-        }
-    } else {
-        auto* rsdt = reinterpret_cast<Rsdt const*>(rsdp.rsdt + kernelBase);
-        for (usize i = 0; i < rsdt->count(); i++) {
-            auto* sdth = reinterpret_cast<Sdth const*>(rsdt->children[i] + kernelBase);
-            func(sdth);
-        }
+        return reinterpret_cast<Sdth const*>(xsdt->children[index] + kernelBase);
     }
+    auto* rsdt = reinterpret_cast<Rsdt const*>(rsdp.rsdt + kernelBase);
+    return reinterpret_cast<Sdth const*>(rsdt->children[index] + kernelBase);
 }
 
+export template <typename Func>
+void iterTables(Rsdp const& rsdp, usize kernelBase, Func&& func) {
+    usize count = _tableCount(rsdp, kernelBase);
+    for (usize i = 0; i < count; i++)
+        func(_tableAt(rsdp, kernelBase, i));
+}
+
+// Returns the first table with the given signature.
 export template <typename T>
 T const* findTable(Rsdp const& rsdp, usize kernelBase) {
-    T const* result = nullptr;
-    iterTables(rsdp, kernelBase, [&](Sdth const* table) {
-        if (table->signature == T::SIGNATURE) {
-            result = table->as<T>();
-        }
-    });
-    return result;
+    usize count = _tableCount(rsdp, kernelBase);
+    for (usize i = 0; i < count; i++) {
+        auto* table = _tableAt(rsdp, kernelBase, i);
+        if (table->signature == T::SIGNATURE)
+            return table->as<T>();
+    }
+    return nullptr;
 }
 
+// MARK: Registry --------------------------------------------------------------
+
+// The firmware tables, enumerated once and checked, indexed by signature.
+// Tables sharing a signature, like SSDTs, are kept in the order the
+// firmware lists them.
+export struct Registry {
+    static constexpr usize MAX_TABLES = 256;
+    static constexpr usize SLOTS = 128;
+    static constexpr Signature DSDT = {'D', 'S', 'D', 'T'};
+
+    struct _Slot {
+        u32 key = 0;
+        u16 start = 0;
+        u16 len = 0;
+    };
+
+    struct _Entry {
+        u32 key;
+        u32 order;
+        Sdth const* table;
+
+        auto operator<=>(_Entry const& other) const {
+            if (key != other.key)
+                return key <=> other.key;
+            return order <=> other.order;
+        }
+    };
+
+    Array<Sdth const*, MAX_TABLES> _tables{};
+    Array<u32, MAX_TABLES> _keys{};
+    usize _len = 0;
+    Array<_Slot, SLOTS> _slots{};
+    usize _rejected = 0;
+
+    static u32 _key(Signature sig) {
+        return u8(sig[0]) | (u8(sig[1]) << 8) | (u8(sig[2]) << 16) | (u32(u8(sig[3])) << 24);
+    }
+
+    static usize _hash(u32 key) {
+        return (key * 0x9e3779b1u) >> 25; // Top 7 bits, one per slot
+    }
+
+    static Res<Registry> build(Rsdp const& rsdp, usize kernelBase) {
+        if (not rsdp.verify())
+            return Error::invalidData("invalid rsdp");
+
+        auto* root = rsdp.isAcpi2() and rsdp.xsdt != 0
+                         ? reinterpret_cast<Sdth const*>(rsdp.xsdt + kernelBase)
+                         : reinterpret_cast<Sdth const*>(rsdp.rsdt + kernelBase);
+        if (not root->isValid())
+            return Error::invalidData("invalid root system description table");
+
+        Registry registry;
+        iterTables(rsdp, kernelBase, [&](Sdth const* table) {
+            registry._add(table);
+        });
+
+        // The DSDT is only referenced from the FADT.
+        for (usize i = 0; i < registry._len; i++) {
+            if (registry._keys[i] != _key(Fadt::SIGNATURE))
+                continue;
+            auto* fadt = registry._tables[i]->as<Fadt>();
+            if (fadt->len >= sizeof(Sdth) + 2 * sizeof(u32) and fadt->dsdt)
+                registry._add(reinterpret_cast<Sdth const*>(fadt->dsdt + kernelBase));
+            break;
+        }
+
+        registry._index();
+        return Ok(registry);
+    }
+
+    // Index tables that were gathered some other way, like from a dump of
+    // the firmware tables.
+    static Registry from(Slice<Sdth const*> tables) {
+        Registry registry;
+        for (auto* table : tables)
+            registry._add(table);
+        registry._index();
+        return registry;
+    }
+
+    void _add(Sdth const* table) {
+        if (not table->isValid()) {
+            logWarn("acpi: rejecting table with bad checksum");
+            _rejected++;
+            return;
+        }
+        if (_len == MAX_TABLES) {
+            logWarn("acpi: too many tables, ignoring the rest");
+            _rejected++;
+            return;
+        }
+        _tables[_len] = table;
+        _keys[_len] = _key(table->signature);
+        _len++;
+    }
+
+    void _index() {
+        Array<_Entry, MAX_TABLES> entries;
+        for (usize i = 0; i < _len; i++)
+            entries[i] = {_keys[i], (u32)i, _tables[i]};
+
+        sort(MutSlice<_Entry>{entries.buf(), _len});
+
+        for (usize i = 0; i < _len; i++) {
+            _tables[i] = entries[i].table;
+            _keys[i] = entries[i].key;
+        }
+
+        for (usize i = 0; i < _len;) {
+            usize j = i;
+            while (j < _len and _keys[j] == _keys[i])
+                j++;
+            _insert(_keys[i], i, j - i);
+            i = j;
+        }
+    }
+
+    void _insert(u32 key, usize start, usize len) {
+        for (usize i = 0; i < SLOTS; i++) {
+            auto& slot = _slots[(_hash(key) + i) % SLOTS];
+            if (slot.len)
+                continue;
+            slot = {key, (u16)start, (u16)len};
+            return;
+        }
+    }
+
+    // All the tables with the given signature.
+    Slice<Sdth const*> all(Signature sig) const {
+        u32 key = _key(sig);
+        for (usize i = 0; i < SLOTS; i++) {
+            auto const& slot = _slots[(_hash(key) + i) % SLOTS];
+            if (not slot.len)
+                break;
+            if (slot.key == key)
+                return {_tables.buf() + slot.start, slot.len};
+        }
+        return {};
+    }
+
+    Sdth const* find(Signature sig, usize index = 0) const {
+        auto tables = all(sig);
+        return index < tables.len() ? tables[index] : nullptr;
+    }
+
+    template <typename T>
+    T const* find() const {
+        auto* table = find(T::SIGNATURE);
+        return table ? table->template as<T>() : nullptr;
+    }
+
+    Slice<Sdth const*> tables() const {
+        return {_tables.buf(), _len};
+    }
+
+    // Number of tables dropped for a bad checksum or lack of room.
+    usize rejected() const {
+        return _rejected;
+    }
+};
+
 } // namespace Vaerk::Acpi
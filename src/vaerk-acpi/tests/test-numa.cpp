@@ -0,0 +1,162 @@
+#include <karm/test>
+
+import Karm.Core;
+import Vaerk.Acpi;
+
+namespace Vaerk::Acpi::Tests {
+
+// Lay a table out record by record, its length is patched on every append.
+template <typename T>
+struct _Table {
+    Vec<u8> buf;
+
+    _Table() {
+        T header{};
+        header.signature = T::SIGNATURE;
+        append(header);
+    }
+
+    template <typename R>
+    void append(R const& value) {
+        auto const* bytes = reinterpret_cast<u8 const*>(&value);
+        for (usize i = 0; i < sizeof(R); i++)
+            buf.pushBack(bytes[i]);
+        reinterpret_cast<Sdth*>(buf.buf())->len = buf.len();
+    }
+
+    // Fields of the header past the SDT one, eg. the SLIT localities.
+    T& header() {
+        return *reinterpret_cast<T*>(buf.buf());
+    }
+
+    T const& operator*() const {
+        return *reinterpret_cast<T const*>(buf.buf());
+    }
+};
+
+template <typename R>
+R _record() {
+    R record{};
+    record.type = u8(R::TYPE);
+    record.len = sizeof(R);
+    return record;
+}
+
+static Srat::LapicRecord _lapic(u8 apicId, u8 domain) {
+    auto record = _record<Srat::LapicRecord>();
+    record.apicId = apicId;
+    record.domainLow = domain;
+    record.flags = Srat::ENABLED;
+    return record;
+}
+
+static Srat::MemoryRecord _memory(u32 domain, u64 base, u64 length) {
+    auto record = _record<Srat::MemoryRecord>();
+    record.domain = domain;
+    record.base = base;
+    record.length = length;
+    record.flags = Srat::ENABLED;
+    return record;
+}
+
+// Two sockets, the second one's proximity domain isn't dense.
+static _Table<Srat> _twoSockets() {
+    _Table<Srat> srat;
+    srat.append(_lapic(0, 0));
+    srat.append(_lapic(1, 0));
+    srat.append(_lapic(2, 4));
+    srat.append(_memory(0, 0x0, 0x8000'0000));
+    srat.append(_memory(4, 0x1'0000'0000, 0x8000'0000));
+    return srat;
+}
+
+test$("acpi-srat-nodes") {
+    auto srat = _twoSockets();
+    NumaTopology numa;
+    numa.load(*srat);
+
+    expectEq$(numa.nodes(), 2uz);
+    expectEq$(numa.domains[1], 4u);
+    expectEq$(numa.cpuList().len(), 3uz);
+    expectEq$(numa.cpuList()[2].node, 1u);
+    expectEq$(numa.nodeOf(0x1000), Opt<u32>{0u});
+    expectEq$(numa.nodeOf(0x1'0000'1000), Opt<u32>{1u});
+    expect$(not numa.nodeOf(0x9000'0000));
+    expectEq$(numa.distance(0, 0), NumaTopology::LOCAL_DISTANCE);
+    expectEq$(numa.distance(0, 1), NumaTopology::REMOTE_DISTANCE);
+    return Ok();
+}
+
+test$("acpi-slit-distances") {
+    auto srat = _twoSockets();
+
+    _Table<Slit> slit;
+    slit.header().localities = 5;
+    for (usize from = 0; from < 5; from++)
+        for (usize to = 0; to < 5; to++)
+            slit.append(u8(from == to ? 10 : 10 + from + to));
+
+    expectEq$((*slit).count(), 5uz);
+    expectEq$((*slit).distance(0, 4), u8(14));
+
+    NumaTopology numa;
+    numa.load(*srat, &*slit);
+    expectEq$(numa.distance(0, 1), u8(14));
+    expectEq$(numa.distance(1, 0), u8(14));
+    expectEq$(numa.distance(1, 1), u8(10));
+    return Ok();
+}
+
+test$("acpi-slit-truncated") {
+    // Eight localities announced, only 16 distances present.
+    _Table<Slit> slit;
+    slit.header().localities = 8;
+    for (usize i = 0; i < 16; i++)
+        slit.append(u8(i % 9 == 0 ? 10 : 20));
+
+    expectEq$((*slit).count(), 0uz);
+    expectEq$((*slit).distance(1, 1), u8(0));
+
+    auto srat = _twoSockets();
+    NumaTopology numa;
+    numa.load(*srat, &*slit);
+    expectEq$(numa.distance(0, 1), NumaTopology::REMOTE_DISTANCE);
+
+    // The same table is accepted once the whole matrix is there.
+    for (usize i = 16; i < 64; i++)
+        slit.append(u8(i % 9 == 0 ? 10 : 20));
+    expectEq$((*slit).count(), 8uz);
+    expectEq$((*slit).distance(1, 1), u8(10));
+    return Ok();
+}
+
+test$("acpi-gicc-ids-match") {
+    auto gicc = _record<Madt::GiccRecord>();
+    gicc.processorUid = 7;
+    gicc.mpidr = 0x8100;
+    gicc.flags = Madt::CPU_ENABLED;
+
+    _Table<Madt> madt;
+    madt.append(gicc);
+
+    auto affinity = _record<Srat::GiccRecord>();
+    affinity.processorUid = 7;
+    affinity.domain = 1;
+    affinity.flags = Srat::ENABLED;
+
+    _Table<Srat> srat;
+    srat.append(affinity);
+
+    CpuTopology cpus;
+    cpus.load(*madt);
+    NumaTopology numa;
+    numa.load(*srat);
+
+    expectEq$(cpus.cpuList().len(), 1uz);
+    expectEq$(numa.cpuList().len(), 1uz);
+    expectEq$(cpus.cpuList()[0].id, numa.cpuList()[0].id);
+    expectEq$(cpus.cpuList()[0].mpidr, u64(0x8100));
+    return Ok();
+}
+
+} // namespace Vaerk::Acpi::Tests
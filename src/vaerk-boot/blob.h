@@ -0,0 +1,35 @@
+#pragma once
+
+import Karm.Core;
+import Vaerk.Lz4;
+
+#include <vaerk-handover/spec.h>
+
+namespace Boot {
+
+// Size of the blob once unpacked, so that its destination can be carved
+// out of FREE memory before calling unpackBlob().
+inline Res<usize> blobSize(Handover::Record const& record, Bytes data) {
+    if (not record.compressed())
+        return Ok(data.len());
+
+    auto frame = try$(Vaerk::Lz4::peek(data));
+    if (not frame.contentSize)
+        return Error::invalidData("compressed blob has no content size");
+    return Ok(*frame.contentSize);
+}
+
+// Unpack the blob into `out`, which may overlap `data` for in place
+// decompression, see Vaerk::Lz4::inPlaceMargin().
+inline Res<usize> unpackBlob(Handover::Record const& record, Bytes data, MutBytes out) {
+    if (record.compressed())
+        return Vaerk::Lz4::decompress(data, out);
+
+    if (out.len() < data.len())
+        return Error::outOfMemory("blob output buffer too small");
+    for (usize i = 0; i < data.len(); i++)
+        out[i] = data[i];
+    return Ok(data.len());
+}
+
+} // namespace Boot
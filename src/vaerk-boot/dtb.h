@@ -0,0 +1,58 @@
+#pragma once
+
+import Karm.Core;
+import Vaerk.Dtb;
+
+#include <vaerk-handover/builder.h>
+
+namespace Boot {
+
+inline void _addRegs(Handover::Builder& builder, Vaerk::Dtb::Prop const& reg, Handover::Tag tag, u32 flags = 0) {
+    Cursor<u32be> c = reg.cells();
+    while (not c.ended()) {
+        auto range = Vaerk::Dtb::AddressSizeCell::parse(c, reg._inherited);
+        if (not range)
+            break;
+        builder.add(tag, flags, range.unwrap().cast<usize>());
+    }
+}
+
+// https://www.kernel.org/doc/Documentation/devicetree/bindings/reserved-memory/reserved-memory.txt
+inline void _addReservedMemory(Handover::Builder& builder, Vaerk::Dtb::Node const& node) {
+    for (auto child : node.iterChildren()) {
+        auto reg = child.getProperty("reg");
+        // Dynamically allocated regions (size/alloc-ranges) have no
+        // address yet, they are left to the kernel.
+        if (not reg)
+            continue;
+
+        // no-map regions must not even be mapped, reusable ones may be
+        // lent to the kernel while their driver isn't using them, both
+        // stay reserved. The binding forbids setting both, no-map wins.
+        if (child.getProperty("no-map"))
+            _addRegs(builder, reg.unwrap(), Handover::Tag::RESERVED, Handover::RESERVED_NO_MAP);
+        else if (child.getProperty("reusable"))
+            _addRegs(builder, reg.unwrap(), Handover::Tag::REUSABLE);
+        else
+            _addRegs(builder, reg.unwrap(), Handover::Tag::RESERVED);
+    }
+}
+
+// Fill the memory map of the builder from the /memory nodes,
+// /reserved-memory children and reservation block of a device tree.
+inline void addMemoryMap(Handover::Builder& builder, Vaerk::Dtb::Blob const& dtb) {
+    for (auto child : dtb.root().iterChildren()) {
+        auto name = child.name();
+        if (name == "memory") {
+            if (auto [reg] = child.getProperty("reg"))
+                _addRegs(builder, reg, Handover::Tag::FREE);
+        } else if (name == "reserved-memory") {
+            _addReservedMemory(builder, child);
+        }
+    }
+
+    for (auto const& reserved : dtb.memoryReservations())
+        builder.add(Handover::Tag::RESERVED, 0, {static_cast<usize>(reserved.address), static_cast<usize>(reserved.size)});
+}
+
+} // namespace Boot
@@ -0,0 +1,75 @@
+#pragma once
+
+import Karm.Core;
+import Karm.Dl.Elf;
+
+#include <vaerk-handover/image.h>
+
+namespace Boot {
+
+template <typename T>
+void _append(Vec<u8>& out, T const& value) {
+    auto const* bytes = reinterpret_cast<u8 const*>(&value);
+    for (usize i = 0; i < sizeof(T); i++)
+        out.pushBack(bytes[i]);
+}
+
+inline Res<Vec<Handover::Segment>> collectSegments(Elf::ElfObject<Elf::Elf64LeAbi>& elf) {
+    Vec<Handover::Segment> segments;
+    for (auto prog : elf.programs()) {
+        if (prog.type() != Elf::Program::LOAD)
+            continue;
+
+        if (prog.filez() > prog.memsz())
+            return Error::invalidData("segment file size exceeds memory size");
+
+        segments.pushBack({
+            .vaddr = prog.vaddr(),
+            .offset = prog.offset(),
+            .filesz = prog.filez(),
+            .memsz = prog.memsz(),
+            .align = max<u64>(prog.align(), Handover::IMAGE_PAGE_SIZE),
+            .flags = (u32)prog.flags(),
+        });
+    }
+
+    if (segments.len() == 0)
+        return Error::invalidData("kernel has no loadable segments");
+
+    return Ok(segments);
+}
+
+// Precompute the load layout of a kernel, followed by its request section,
+// see Handover::Image. Used at build time by handover-dump, and by loaders
+// booting a kernel that comes without one.
+inline Res<Vec<u8>> buildImage(Elf::ElfObject<Elf::Elf64LeAbi>& elf) {
+    auto requests =
+        try$(elf.section(Handover::REQUEST_SECTION))
+            .data.cast<Handover::Request>();
+    try$(Handover::parseRequests(requests));
+
+    auto segments = try$(collectSegments(elf));
+
+    u64 start = ~u64(0), end = 0;
+    for (auto const& s : segments) {
+        start = min(start, s.vaddr & ~(s.align - 1));
+        end = max(end, s.end());
+    }
+    end = (end + Handover::IMAGE_PAGE_SIZE - 1) & ~(Handover::IMAGE_PAGE_SIZE - 1);
+
+    Vec<u8> out;
+    _append(out, Handover::Image{
+                     .magic = Handover::IMAGE_MAGIC,
+                     .len = (u32)segments.len(),
+                     .entry = elf.header().entry,
+                     .start = start,
+                     .size = end - start,
+                 });
+    for (auto const& s : segments)
+        _append(out, s);
+    for (auto const& r : requests)
+        _append(out, r);
+    return Ok(out);
+}
+
+} // namespace Boot
@@ -0,0 +1,18 @@
+#pragma once
+
+import Karm.Core;
+import Vaerk.Acpi;
+
+#include <vaerk-handover/builder.h>
+
+namespace Boot {
+
+// Tag the FREE records with the node owning them, so that allocators can
+// stay node local. Records are split at the node boundaries and only
+// coalesce with records of the same node afterward.
+inline void tagNumaNodes(Handover::Builder& builder, Vaerk::Acpi::NumaTopology const& numa) {
+    for (auto const& range : numa.memoryList())
+        builder.flagFree({range.start, range.size}, Handover::FREE_NUMA | range.node);
+}
+
+} // namespace Boot
@@ -0,0 +1,69 @@
+#pragma once
+
+import Karm.Core;
+import Vaerk.Pmm;
+
+#include <vaerk-handover/spec.h>
+
+namespace Boot {
+
+// Bootstrap a buddy allocator from the FREE records of the payload.
+// Its frame array is carved out of the first FREE record large enough to
+// hold it, and is accessed through `virtOffset`.
+inline Res<Vaerk::Pmm::Buddy> initBuddy(Handover::Payload const& payload, usize virtOffset = Handover::UPPER_HALF) {
+    using Vaerk::Pmm::Buddy;
+    using Vaerk::Pmm::pageAlignDown;
+    using Vaerk::Pmm::pageAlignUp;
+
+    auto span = payload.usableRange<urange>();
+    if (span.empty())
+        return Error::outOfMemory("no usable memory");
+
+    // Grow the span down to a page boundary, it still has to reach the
+    // end of the last FREE record.
+    usize start = pageAlignDown(span.start);
+    span.size += span.start - start;
+    span.start = start;
+
+    usize frames = Buddy::framesFor(span);
+    usize metadataSize = pageAlignUp(Buddy::metadataSize(span));
+
+    Opt<urange> metadata = NONE;
+    for (auto const& r : payload) {
+        if (r.tag != Handover::Tag::FREE)
+            continue;
+        usize at = pageAlignUp(r.start);
+        if (at + metadataSize <= r.end()) {
+            metadata = urange{at, metadataSize};
+            break;
+        }
+    }
+
+    if (not metadata)
+        return Error::outOfMemory("no room for the allocator metadata");
+
+    Buddy buddy{
+        span.start,
+        MutSlice<Buddy::Frame>{
+            reinterpret_cast<Buddy::Frame*>(metadata->start + virtOffset),
+            frames,
+        },
+    };
+
+    for (auto const& r : payload) {
+        if (r.tag != Handover::Tag::FREE)
+            continue;
+        auto range = r.range<urange>();
+        if (not range.overlaps(*metadata)) {
+            buddy.release(range);
+            continue;
+        }
+        auto [lower, upper] = range.split(*metadata);
+        buddy.release(lower);
+        buddy.release(upper);
+    }
+
+    return Ok(buddy);
+}
+
+} // namespace Boot
@@ -0,0 +1,128 @@
+#pragma once
+
+import Karm.Core;
+import Vaerk.Dtb;
+
+// Trees written after the virt machines of QEMU, like the seed trees of
+// src/utilities/dtb-fuzz/corpus, keeping what matters to the memory map.
+
+namespace Boot::Tests {
+
+using namespace Karm::Literals;
+
+// A single range, with two address and two size cells.
+static Res<> _reg(Vaerk::Dtb::Writer& w, u64 address, u64 size) {
+    Array<u64be, 2> reg = {address, size};
+    return w.prop("reg"s, Bytes{reinterpret_cast<u8 const*>(reg.buf()), sizeof(reg)});
+}
+
+static Res<> _cells(Vaerk::Dtb::Writer& w) {
+    try$(w.prop("#address-cells"s, 2u));
+    try$(w.prop("#size-cells"s, 2u));
+    return Ok();
+}
+
+static Res<> _cpus(Vaerk::Dtb::Writer& w, usize count) {
+    try$(w.beginNode("cpus"s));
+    try$(w.prop("#address-cells"s, 1u));
+    try$(w.prop("#size-cells"s, 0u));
+    for (usize i = 0; i < count; i++) {
+        try$(w.beginNode(Io::format("cpu@{}", i)));
+        try$(w.prop("device_type"s, "cpu"s));
+        try$(w.prop("reg"s, u32(i)));
+        try$(w.endNode());
+    }
+    return w.endNode();
+}
+
+// A no-map firmware region at the bottom of RAM, and a reusable CMA pool.
+static Res<Bytes> _qemuRiscv64Virt(MutBytes buf) {
+    Vaerk::Dtb::Writer w{buf};
+    try$(w.beginNode(""s));
+    try$(_cells(w));
+    try$(w.prop("compatible"s, "riscv-virtio"s));
+    try$(w.prop("model"s, "riscv-virtio,qemu"s));
+
+    try$(w.beginNode("chosen"s));
+    try$(w.prop("linux,initrd-end"s, u64(0x88400000)));
+    try$(w.prop("linux,initrd-start"s, u64(0x88000000)));
+    try$(w.prop("bootargs"s, "console=ttyS0 earlycon"s));
+    try$(w.prop("stdout-path"s, "/soc/serial@10000000"s));
+    try$(w.endNode());
+
+    try$(w.beginNode("memory@80000000"s));
+    try$(w.prop("device_type"s, "memory"s));
+    try$(_reg(w, 0x80000000, 0x10000000));
+    try$(w.endNode());
+
+    try$(w.beginNode("reserved-memory"s));
+    try$(_cells(w));
+    try$(w.prop("ranges"s));
+    try$(w.beginNode("mmode_resv0@80000000"s));
+    try$(_reg(w, 0x80000000, 0x40000));
+    try$(w.prop("no-map"s));
+    try$(w.endNode());
+    try$(w.beginNode("linux,cma@8c000000"s));
+    try$(w.prop("reusable"s));
+    try$(_reg(w, 0x8c000000, 0x2000000));
+    try$(w.prop("linux,cma-default"s));
+    try$(w.endNode());
+    try$(w.endNode());
+
+    try$(_cpus(w, 2));
+
+    try$(w.beginNode("soc"s));
+    try$(_cells(w));
+    try$(w.prop("ranges"s));
+    try$(w.beginNode("serial@10000000"s));
+    try$(_reg(w, 0x10000000, 0x100));
+    try$(w.endNode());
+    try$(w.endNode());
+
+    try$(w.endNode());
+    return w.finish();
+}
+
+// A reservation block entry, a no-map secure monitor and a plain reserved
+// framebuffer.
+static Res<Bytes> _qemuAarch64Virt(MutBytes buf) {
+    Vaerk::Dtb::Writer w{buf};
+    try$(w.reserve(0x48000000, 0x100000));
+    try$(w.beginNode(""s));
+    try$(w.prop("model"s, "linux,dummy-virt"s));
+    try$(_cells(w));
+    try$(w.prop("compatible"s, "linux,dummy-virt"s));
+
+    try$(w.beginNode("memory@40000000"s));
+    try$(_reg(w, 0x40000000, 0x20000000));
+    try$(w.prop("device_type"s, "memory"s));
+    try$(w.endNode());
+
+    try$(w.beginNode("reserved-memory"s));
+    try$(_cells(w));
+    try$(w.prop("ranges"s));
+    try$(w.beginNode("secmon@5e000000"s));
+    try$(_reg(w, 0x5e000000, 0x200000));
+    try$(w.prop("no-map"s));
+    try$(w.endNode());
+    try$(w.beginNode("framebuffer@5f000000"s));
+    try$(_reg(w, 0x5f000000, 0x800000));
+    try$(w.endNode());
+    try$(w.endNode());
+
+    try$(w.beginNode("pl011@9000000"s));
+    try$(_reg(w, 0x9000000, 0x1000));
+    try$(w.endNode());
+
+    try$(_cpus(w, 4));
+
+    try$(w.beginNode("chosen"s));
+    try$(w.prop("stdout-path"s, "/pl011@9000000"s));
+    try$(w.prop("kaslr-seed"s, u64(0x1234)));
+    try$(w.endNode());
+
+    try$(w.endNode());
+    return w.finish();
+}
+
+} // namespace Boot::Tests
@@ -0,0 +1,68 @@
+#include <karm/test>
+#include <vaerk-boot/dtb.h>
+
+#include "fixtures.h"
+
+import Karm.Core;
+import Vaerk.Dtb;
+
+namespace Boot::Tests {
+
+struct _Expected {
+    Handover::Tag tag;
+    u32 flags;
+    u64 start;
+    u64 end;
+};
+
+static Res<> _checkMemoryMap(Res<Bytes> (*write)(MutBytes), Slice<_Expected> expected) {
+    alignas(u64) Array<u8, 4096> tree = {};
+    auto dtb = try$(Vaerk::Dtb::Blob::open(try$(write(MutBytes{tree.buf(), tree.len()}))));
+    try$(dtb.validate());
+
+    alignas(u64) Array<u8, 4096> buf = {};
+    Handover::Builder builder{MutSlice<u8>{buf.buf(), buf.len()}};
+    addMemoryMap(builder, dtb);
+    auto& payload = builder.finalize();
+
+    if (payload.len != expected.len())
+        return Error::other("unexpected record count");
+
+    for (usize i = 0; i < expected.len(); i++) {
+        auto const& record = payload.records[i];
+        auto const& want = expected[i];
+        if (record.tag != want.tag or record.flags != want.flags or
+            record.start != want.start or record.end() != want.end)
+            return Error::other("unexpected record");
+    }
+
+    return Ok();
+}
+
+test$("boot-dtb-riscv-virt") {
+    // A no-map firmware region at the bottom of RAM, and a reusable CMA pool.
+    Array<_Expected, 4> expected = {
+        _Expected{Handover::Tag::RESERVED, Handover::RESERVED_NO_MAP, 0x80000000, 0x80040000},
+        _Expected{Handover::Tag::FREE, 0, 0x80040000, 0x8c000000},
+        _Expected{Handover::Tag::REUSABLE, 0, 0x8c000000, 0x8e000000},
+        _Expected{Handover::Tag::FREE, 0, 0x8e000000, 0x90000000},
+    };
+    return _checkMemoryMap(_qemuRiscv64Virt, expected);
+}
+
+test$("boot-dtb-aarch64-virt") {
+    // A reservation block entry, a no-map secure monitor and a plain
+    // reserved framebuffer.
+    Array<_Expected, 7> expected = {
+        _Expected{Handover::Tag::FREE, 0, 0x40000000, 0x48000000},
+        _Expected{Handover::Tag::RESERVED, 0, 0x48000000, 0x48100000},
+        _Expected{Handover::Tag::FREE, 0, 0x48100000, 0x5e000000},
+        _Expected{Handover::Tag::RESERVED, Handover::RESERVED_NO_MAP, 0x5e000000, 0x5e200000},
+        _Expected{Handover::Tag::FREE, 0, 0x5e200000, 0x5f000000},
+        _Expected{Handover::Tag::RESERVED, 0, 0x5f000000, 0x5f800000},
+        _Expected{Handover::Tag::FREE, 0, 0x5f800000, 0x60000000},
+    };
+    return _checkMemoryMap(_qemuAarch64Virt, expected);
+}
+
+} // namespace Boot::Tests
@@ -0,0 +1,38 @@
+#include <karm/test>
+#include <vaerk-boot/pmm.h>
+#include <vaerk-handover/builder.h>
+
+import Karm.Core;
+import Vaerk.Pmm;
+
+namespace Boot::Tests {
+
+test$("boot-init-buddy") {
+    alignas(u64) Array<u8, 4096> buf = {};
+    Handover::Builder builder{MutSlice<u8>{buf.buf(), buf.len()}};
+
+    // The span starts in the middle of a page and ends on the last one.
+    builder.add(Handover::Tag::FREE, 0, {0x1800, 0x40000 - 0x1800});
+    builder.add(Handover::Tag::FREE, 0, {0x80000, 0x80000});
+    auto& payload = builder.finalize();
+
+    // The metadata lands at 0x2000, the first page aligned FREE address,
+    // point it at host memory.
+    alignas(u64) Array<u8, 2 * Vaerk::Pmm::PAGE_SIZE> metadata = {};
+    usize virtOffset = reinterpret_cast<usize>(metadata.buf()) - 0x2000;
+
+    auto buddy = try$(initBuddy(payload, virtOffset));
+    expectEq$(buddy.span().start, 0x1000uz);
+    expectEq$(buddy.span().end(), 0x100000uz);
+
+    // Everything but the partial first page and the metadata page.
+    expectEq$(buddy.freePages(), 0x3duz + 0x80uz);
+
+    usize highest = 0;
+    while (auto page = buddy.alloc(0))
+        highest = max(highest, page.unwrap());
+    expectEq$(highest, 0xff000uz);
+    return Ok();
+}
+
+} // namespace Boot::Tests
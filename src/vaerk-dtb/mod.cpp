@@ -116,6 +116,19 @@ static bool _sniffStr(Bytes extra) {
     return hasPrint;
 }
 
+void _inheritCells(InheritedProperties& inherited, Str name, Bytes value) {
+    if (value.len() != sizeof(u32be))
+        return;
+
+    usize cells = value.cast<u32be>()[0];
+    if (name == "#address-cells")
+        inherited.addressCells = cells;
+    else if (name == "#size-cells")
+        inherited.sizeCells = cells;
+    else if (name == "#interrupt-cells")
+        inherited.interruptCells = cells;
+}
+
 // MARK: Tokens ----------------------------------------------------------------
 
 Tuple<Str, Opt<usize>> _parseName(Str str) {
@@ -127,6 +140,15 @@ Tuple<Str, Opt<usize>> _parseName(Str str) {
     return {name, addr};
 }
 
+// Cheaper than _parseName() when only the name is needed.
+static Str _nodeName(Str fullname) {
+    for (usize i = 0; i < fullname.len(); i++) {
+        if (fullname[i] == '@')
+            return Str{fullname.buf(), i};
+    }
+    return fullname;
+}
+
 struct Token {
     enum struct Type : u32 {
         BEGIN_NODE = 0x00000001,
@@ -144,8 +166,7 @@ struct Token {
     Bytes extra = {};
 
     Str name() const {
-        auto [name, _] = _parseName(fullname);
-        return name;
+        return _nodeName(fullname);
     }
 
     Opt<usize> address() const {
@@ -167,33 +188,62 @@ struct Token {
 
 // MARK: Iterators -------------------------------------------------------------
 
+static bool _hasNul(Bytes bytes) {
+    for (auto b : bytes) {
+        if (b == 0)
+            return true;
+    }
+    return false;
+}
+
+// Same limit as libfdt, it keeps the recursive walks (eg. dump()) bounded.
+static constexpr usize MAX_DEPTH = 64;
+
+// Iterates over the structure block, stopping at the first malformed token
+// or at a node nested deeper than MAX_DEPTH. Once the blob went through
+// Blob::validate(), the iterator is `trusted` and the per-token bounds
+// checks are skipped.
 struct TokenIter {
     Bytes strings;
     Io::BScan tokens;
+    bool trusted = false;
+    usize depth = 0; // Relative to where the iteration started
 
     Opt<Token> next() {
-        if (tokens.ended())
+        if (tokens.rem() < sizeof(u32))
             return NONE;
         auto type = static_cast<Token::Type>(tokens.nextU32be());
         if (type == Token::BEGIN_NODE) {
+            if (depth == MAX_DEPTH)
+                return NONE;
+            if (not trusted and not _hasNul(tokens.remBytes()))
+                return NONE;
             auto fullname = tokens.nextCStr();
             tokens.align(sizeof(u32));
+            depth++;
             return Some(Token{.type = type, .fullname = fullname});
         } else if (type == Token::END_NODE) {
+            if (depth > 0)
+                depth--;
             return Some(Token{.type = type});
         } else if (type == Token::PROP) {
+            if (not trusted and tokens.rem() < 2 * sizeof(u32))
+                return NONE;
             auto len = tokens.nextU32be();
             auto nameoff = tokens.nextU32be();
+            if (not trusted and
+                (nameoff >= strings.len() or
+                 not _hasNul(sub(strings, nameoff, strings.len())) or
+                 len > tokens.rem()))
+                return NONE;
             auto name = Io::BScan{strings}.skip(nameoff).nextCStr();
             auto extra = tokens.nextBytes(len);
             tokens.align(sizeof(u32));
             return Some(Token{.type = type, .fullname = name, .extra = extra});
         } else if (type == Token::NOP) {
             return Some(Token{.type = type});
-        } else if (type == Token::END) {
-            return NONE;
         } else {
-            panic("invalid token");
+            return NONE;
         }
     }
 };
@@ -249,6 +299,13 @@ export struct Prop {
         return C::parse(c, _inherited);
     }
 
+    // The payload as a list of cells, regardless of what it sniffs as.
+    Slice<u32be> cells() const {
+        if ((raw().len() % sizeof(u32be)) != 0)
+            return {};
+        return raw().cast<u32be>();
+    }
+
     Slice<u64be> regs64() const {
         if (sniff() == U64)
             return raw().cast<u64be>();
@@ -274,6 +331,8 @@ export struct Prop {
     };
 
     [[nodiscard]] auto iterStr() const {
+        if (not raw().len())
+            return StrIter(Str{});
         Str str = sub(raw(), 0, raw().len() - 1).cast<char>();
         return StrIter(str);
     }
@@ -317,24 +376,20 @@ export struct Node {
     Node(TokenIter tokens, InheritedProperties inherited)
         : _tokens(tokens),
           _inherited(inherited) {
-        if (auto [addressCells] = getProperty("#address-cells")) {
-            if (auto [cells] = addressCells.as<u32be>()) {
-                _inherited.addressCells = cells;
-            }
-        }
+        for (auto prop : iterProp())
+            _inheritCells(_inherited, prop._token.fullname, prop.raw());
+    }
 
-        if (auto [sizeCells] = getProperty("#size-cells")) {
-            if (auto [cells] = sizeCells.as<u32be>()) {
-                _inherited.sizeCells = cells;
-            }
-        }
+    struct _Resolved {};
 
-        if (auto [interruptCells] = getProperty("#interrupt-cells")) {
-            if (auto [cells] = interruptCells
-                                   .as<u32be>()) {
-                _inherited.interruptCells = cells;
-            }
-        }
+    Node(_Resolved, TokenIter tokens, InheritedProperties inherited)
+        : _tokens(tokens),
+          _inherited(inherited) {}
+
+    // Build a node whose cells have already been resolved (eg. by an Index),
+    // this skips the property scan done by the regular constructor.
+    static Node resolved(TokenIter tokens, InheritedProperties inherited) {
+        return Node{_Resolved{}, tokens, inherited};
     }
 
     Token token() const {
@@ -362,12 +417,17 @@ export struct Node {
         InheritedProperties _inherited;
 
         Opt<Prop> next() {
-            auto token = _tokens.next();
-            if (not token)
-                return NONE;
-            if (token->type != Token::PROP)
-                return NONE;
-            return Some(Prop{token.unwrap(), _inherited});
+            while (true) {
+                auto token = _tokens.next();
+                if (not token)
+                    return NONE;
+                // The patcher leaves NOPs in between properties.
+                if (token->type == Token::NOP)
+                    continue;
+                if (token->type != Token::PROP)
+                    return NONE;
+                return Some(Prop{token.unwrap(), _inherited});
+            }
         }
     };
 
@@ -467,12 +527,454 @@ export struct Node {
     }
 };
 
+// MARK: Phandles --------------------------------------------------------------
+
+export struct IndexKey {
+    u32 key;
+    u32 node;
+
+    auto operator<=>(IndexKey const&) const = default;
+};
+
+// Find the first entry whose key is not less than `key`.
+static usize _lowerBound(Slice<IndexKey> keys, u32 key) {
+    usize lo = 0, hi = keys.len();
+    while (lo < hi) {
+        usize mid = lo + (hi - lo) / 2;
+        if (keys[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static bool _isPhandle(Str name, Bytes value) {
+    return value.len() == sizeof(u32be) and
+           (name == "phandle" or name == "linux,phandle");
+}
+
+// MARK: Index -----------------------------------------------------------------
+
+constexpr u32 _hashStr(Str str) {
+    // FNV-1a
+    u32 hash = 0x811c9dc5;
+    for (auto c : str) {
+        hash ^= static_cast<u8>(c);
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+export struct IndexNode {
+    static constexpr u32 NIL = 0xffffffff;
+
+    u32 offset = 0; // Offset of the BEGIN_NODE token in the structure block
+    u32 parent = NIL;
+    u32 firstChild = NIL;
+    u32 nextSibling = NIL;
+    u32 end = 0; // One past the last descendant
+    u32 firstProp = 0;
+    u32 propLen = 0;
+    Str fullname = "";
+    InheritedProperties inherited = {};
+};
+
+export struct IndexProp {
+    Str name;
+    Bytes value;
+};
+
+export struct Blob;
+
+// A flattened view of the structure block, built in a single pass into
+// caller-supplied storage so that it can be used before any allocator exists.
+//
+// measure() and build() are defined after Blob, which also keeps one of its
+// own to follow parents and phandles.
+export struct Index {
+    struct Arena {
+        MutSlice<IndexNode> nodes;
+        MutSlice<IndexProp> props;
+        MutSlice<IndexKey> phandles;
+        MutSlice<IndexKey> names;
+    };
+
+    struct Size {
+        usize nodes = 0;
+        usize props = 0;
+        usize phandles = 0;
+    };
+
+    Bytes _strings;
+    Bytes _structure;
+    Slice<IndexNode> _nodes;
+    Slice<IndexProp> _props;
+    Slice<IndexKey> _phandles;
+    Slice<IndexKey> _names;
+
+    // Count how much storage build() is going to need.
+    static Size measure(Blob const& blob);
+
+    static Res<Index> build(Blob const& blob, Arena arena);
+
+    usize len() const {
+        return _nodes.len();
+    }
+
+    u32 root() const {
+        return 0;
+    }
+
+    IndexNode const& operator[](u32 index) const {
+        return _nodes[index];
+    }
+
+    Slice<IndexProp> props(u32 index) const {
+        auto const& node = _nodes[index];
+        return sub(_props, node.firstProp, node.firstProp + node.propLen);
+    }
+
+    Node node(u32 index) const {
+        auto const& n = _nodes[index];
+        return Node::resolved(
+            {_strings, Io::BScan{sub(_structure, n.offset, _structure.len())}},
+            n.inherited
+        );
+    }
+
+    Opt<Prop> getProperty(u32 index, Str name) const {
+        for (auto const& prop : props(index)) {
+            if (prop.name == name)
+                return Some(Prop{
+                    Token{.type = Token::PROP, .fullname = prop.name, .extra = prop.value},
+                    _nodes[index].inherited,
+                });
+        }
+        return NONE;
+    }
+
+    // Match a child either by its full name ("serial@1000") or by its
+    // name alone ("chosen"), like Node::findChildren().
+    Opt<u32> findChild(u32 parent, Str name) const {
+        for (u32 child = _nodes[parent].firstChild;
+             child != IndexNode::NIL;
+             child = _nodes[child].nextSibling) {
+            auto fullname = _nodes[child].fullname;
+            if (fullname == name)
+                return Some(child);
+            auto [childName, _] = _parseName(fullname);
+            if (childName == name)
+                return Some(child);
+        }
+        return NONE;
+    }
+
+    Opt<u32> byPath(Str path) const {
+        if (not _nodes.len())
+            return NONE;
+
+        Io::SScan s{path};
+        u32 curr = root();
+        while (not s.ended()) {
+            s.skip(Re::zeroOrMore('/'_re));
+            auto component = s.token(Re::until('/'_re));
+            if (not component)
+                continue;
+            curr = try$(findChild(curr, component));
+        }
+        return Some(curr);
+    }
+
+    Opt<u32> byPhandle(u32 phandle) const {
+        usize i = _lowerBound(_phandles, phandle);
+        if (i >= _phandles.len() or _phandles[i].key != phandle)
+            return NONE;
+        return Some(_phandles[i].node);
+    }
+
+    // Nodes are in document order, so sorted by offset.
+    Opt<u32> byOffset(usize offset) const {
+        usize lo = 0, hi = _nodes.len();
+        while (lo < hi) {
+            usize mid = lo + (hi - lo) / 2;
+            if (_nodes[mid].offset < offset)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo >= _nodes.len() or _nodes[lo].offset != offset)
+            return NONE;
+        return Some(static_cast<u32>(lo));
+    }
+
+    // The index of a node of the same blob.
+    Opt<u32> indexOf(Node const& node) const {
+        return byOffset(_structure.len() - node._tokens.tokens.rem());
+    }
+
+    // Returns the first node, in document order, with the given name.
+    Opt<u32> byName(Str name) const {
+        u32 hash = _hashStr(name);
+        for (usize i = _lowerBound(_names, hash); i < _names.len() and _names[i].key == hash; i++) {
+            auto [nodeName, _] = _parseName(_nodes[_names[i].node].fullname);
+            if (nodeName == name)
+                return Some(_names[i].node);
+        }
+        return NONE;
+    }
+};
+
+// Heap storage for the Index a Blob builds on demand to follow references
+// between nodes. Only the storage is kept, the Index itself is a view that
+// is cheap to recreate, which keeps copies of the Blob valid.
+struct _IndexStorage {
+    Vec<IndexNode> nodes;
+    Vec<IndexProp> props;
+    Vec<IndexKey> phandles;
+    Vec<IndexKey> names;
+
+    Index::Arena arena() {
+        return {
+            {nodes.buf(), nodes.len()},
+            {props.buf(), props.len()},
+            {phandles.buf(), phandles.len()},
+            {names.buf(), names.len()},
+        };
+    }
+};
+
+// MARK: Interrupts ------------------------------------------------------------
+
+static constexpr usize MAX_INTERRUPT_DEPTH = 16;
+
+export struct Interrupt {
+    Node controller;
+    Slice<u32be> specifier;
+};
+
+static u32 _cellAt(Slice<u32be> cells, usize i) {
+    if (i >= cells.len())
+        return 0;
+    return cells[i];
+}
+
+// MARK: Ranges ----------------------------------------------------------------
+
+// A window of a bus address space mapped into its parent address space.
+export struct Window {
+    u64 child;
+    u64 parent;
+    u64 size;
+
+    bool contains(u64 addr) const {
+        return addr >= child and addr - child < size;
+    }
+
+    u64 translate(u64 addr) const {
+        return parent + (addr - child);
+    }
+
+    void repr(Io::Emit& e) const {
+        e("{:#x}-{:#x} -> {:#x}", child, child + size, parent);
+    }
+};
+
+static Opt<u64> _readCells(Slice<u32be> cells, usize& i, usize n) {
+    if (n > 2 or i + n > cells.len())
+        return NONE;
+    u64 value = 0;
+    for (usize j = 0; j < n; j++)
+        value = (value << 32) | cells[i++];
+    return Some(value);
+}
+
+// Decodes the entries of a `ranges` or `dma-ranges` property, the child
+// address and size use the cells of the bus node, the parent address the
+// cells of its parent.
+struct RangesIter {
+    Slice<u32be> cells;
+    usize childCells;
+    usize parentCells;
+    usize sizeCells;
+    usize i = 0;
+
+    Opt<Window> next() {
+        if (i >= cells.len())
+            return NONE;
+        auto child = try$(_readCells(cells, i, childCells));
+        auto parent = try$(_readCells(cells, i, parentCells));
+        auto size = try$(_readCells(cells, i, sizeCells));
+        return Some(Window{child, parent, size});
+    }
+};
+
+// MARK: Query -----------------------------------------------------------------
+
+// A path compiled once into its components, eg. `/soc/serial@*`.
+//
+// A component without a unit address matches any unit address, `name@*`
+// requires one, and `*` matches any node. A path that doesn't start with
+// `/` begins with an alias from `/aliases`.
+export struct Query {
+    static constexpr usize MAX_COMPONENTS = 16;
+
+    struct Component {
+        enum struct Kind : u8 {
+            ANY,
+            NAME,
+            FULLNAME,
+            ANY_UNIT,
+        };
+
+        using enum Kind;
+
+        Kind kind = ANY;
+        Str name = "";
+
+        // Full names are unique among siblings, so at most one node can match.
+        bool unique() const {
+            return kind == FULLNAME;
+        }
+
+        bool match(Str fullname) const {
+            if (kind == ANY)
+                return true;
+            if (kind == FULLNAME)
+                return fullname == name;
+            auto nodeName = _nodeName(fullname);
+            if (kind == ANY_UNIT and nodeName.len() == fullname.len())
+                return false;
+            return nodeName == name;
+        }
+    };
+
+    Str _alias = "";
+    Array<Component, MAX_COMPONENTS> _components = {};
+    usize _len = 0;
+
+    Res<> _push(Str component) {
+        if (_len >= MAX_COMPONENTS)
+            return Error::invalidInput("query too deep");
+
+        Component c;
+        if (component == "*") {
+            c.kind = Component::ANY;
+        } else if (auto name = _nodeName(component); name.len() == component.len()) {
+            c.kind = Component::NAME;
+            c.name = component;
+        } else if (Str{component.buf() + name.len(), component.len() - name.len()} == "@*") {
+            c.kind = Component::ANY_UNIT;
+            c.name = name;
+        } else {
+            c.kind = Component::FULLNAME;
+            c.name = component;
+        }
+        _components[_len++] = c;
+        return Ok();
+    }
+
+    static Res<Query> compile(Str path) {
+        Query query;
+        Io::SScan s{path};
+        if (not path.len() or path[0] != '/') {
+            query._alias = s.token(Re::until('/'_re));
+            if (not query._alias)
+                return Error::invalidInput("empty alias");
+        }
+
+        while (not s.ended()) {
+            s.skip(Re::zeroOrMore('/'_re));
+            auto component = s.token(Re::until('/'_re));
+            if (component)
+                try$(query._push(component));
+        }
+        return Ok(query);
+    }
+
+    Slice<Component> components() const {
+        return sub(_components, 0, _len);
+    }
+
+    // Whether at most one node can match the first `len` components.
+    bool unique(usize len) const {
+        for (usize i = 0; i < len; i++) {
+            if (not _components[i].unique())
+                return false;
+        }
+        return true;
+    }
+};
+
+// Evaluates a query in a single forward scan of the structure block,
+// subtrees that can't match are skipped without looking at their names.
+struct QueryIter {
+    Query _query;
+    TokenIter _tokens;
+    usize _depth = 0;   // Number of open nodes
+    usize _matched = 0; // Number of open nodes on a matching chain
+    bool _ended = false;
+    Array<InheritedProperties, Query::MAX_COMPONENTS + 2> _inherited = {};
+
+    Opt<Node> next() {
+        auto components = _query.components();
+        while (not _ended) {
+            auto before = _tokens;
+            auto token = _tokens.next();
+            if (not token) {
+                _ended = true;
+                break;
+            }
+
+            if (token->type == Token::BEGIN_NODE) {
+                _depth++;
+                if (_depth != _matched + 1)
+                    continue;
+
+                // Level of the node in the tree, the root is level 0.
+                usize level = _depth - 1;
+                if (level > 0 and not components[level - 1].match(token->fullname))
+                    continue;
+
+                if (level == components.len()) {
+                    _ended = _query.unique(components.len());
+                    return Some(Node{before, _inherited[level]});
+                }
+
+                _matched = _depth;
+                _inherited[_depth] = _inherited[level];
+            } else if (token->type == Token::END_NODE) {
+                if (_depth == _matched) {
+                    // Leaving the only node that could match at this level.
+                    if (_matched > 1 and _query.unique(_matched - 1)) {
+                        _ended = true;
+                        break;
+                    }
+                    _matched--;
+                }
+                _depth--;
+            } else if (token->type == Token::PROP and _depth == _matched and _depth > 0) {
+                _inheritCells(_inherited[_depth], token->fullname, token->extra);
+            }
+        }
+        return NONE;
+    }
+};
+
 // MARK: Blob ------------------------------------------------------------------
 
 export u32 MAGIC = 0xD00DFEED;
+export u32 VERSION = 17;
+export u32 LAST_COMPATIBLE_VERSION = 16;
+
+static usize _align4(usize value) {
+    return (value + 3) & ~usize(3);
+}
 
 export struct Blob : Io::BChunk {
     Header _header;
+    bool _validated = false;
+    mutable Opt<_IndexStorage> _index = NONE;
 
     Header const& header() const { return _header; }
 
@@ -498,10 +1000,16 @@ export struct Blob : Io::BChunk {
         if (header.memoryReservationBlockOffset >= header.totalSize)
             return Error::invalidData("invalid memory reservation block offset");
 
-        if (not header.dtbRange().contains(header.structureBlockRange()))
+        // Offset and size come straight from the blob, compare them
+        // without letting their sum wrap around.
+        auto fits = [&](u32 offset, u32 size) {
+            return offset <= header.totalSize and size <= header.totalSize - offset;
+        };
+
+        if (not fits(header.structureBlockOffset, header.structureBlockSize))
             return Error::invalidData("invalid structure block range");
 
-        if (not header.dtbRange().contains(header.stringsRange()))
+        if (not fits(header.stringsBlockOffset, header.stringsBlockSize))
             return Error::invalidData("invalid strings block range");
 
         return Ok(Blob{dtb, header});
@@ -515,7 +1023,7 @@ export struct Blob : Io::BChunk {
         return sub(bytes(), _header.structureBlockRange().cast<usize>());
     }
 
-    Slice<ReserveEntry> memoryReservations() {
+    Slice<ReserveEntry> memoryReservations() const {
         auto reservations = sub(bytes(), _header.memoryReservationBlockOffset, _header.totalSize).cast<ReserveEntry>();
         usize len = 0;
         for (auto& r : reservations) {
@@ -527,13 +1035,332 @@ export struct Blob : Io::BChunk {
     }
 
     TokenIter iterTokens() const {
-        return {stringsBlock(), structureBlock()};
+        return {stringsBlock(), structureBlock(), _validated};
+    }
+
+    // Check the whole blob in one linear pass: reservation block, token
+    // types, nesting, alignment, property bounds and string offsets.
+    // Once it succeeds, iterating the blob skips the per-token checks.
+    Res<> validate() {
+        if (_header.lastCompatibleVersion > VERSION)
+            return Error::invalidData("unsupported version");
+
+        if (_header.structureBlockOffset % sizeof(u32) != 0)
+            return Error::invalidData("misaligned structure block");
+
+        if (_header.memoryReservationBlockOffset % sizeof(u64) != 0)
+            return Error::invalidData("misaligned memory reservation block");
+
+        usize reservation = _header.memoryReservationBlockOffset;
+        while (true) {
+            if (reservation + sizeof(ReserveEntry) > _header.totalSize)
+                return Error::invalidData("unterminated memory reservation block");
+            auto entry = Io::BScan{bytes()}.skip(reservation).next<ReserveEntry>();
+            reservation += sizeof(ReserveEntry);
+            if (not entry)
+                break;
+        }
+
+        auto strings = stringsBlock();
+        Io::BScan tokens{structureBlock()};
+        usize depth = 0;
+        bool root = false;
+        bool hasChildren = false;
+
+        while (true) {
+            if (tokens.rem() < sizeof(u32))
+                return Error::invalidData("missing end token");
+
+            auto type = static_cast<Token::Type>(tokens.nextU32be());
+            if (type == Token::BEGIN_NODE) {
+                if (depth == 0 and root)
+                    return Error::invalidData("multiple root nodes");
+                if (not _hasNul(tokens.remBytes()))
+                    return Error::invalidData("unterminated node name");
+                tokens.nextCStr();
+                tokens.align(sizeof(u32));
+                root = true;
+                hasChildren = false;
+                if (++depth > MAX_DEPTH)
+                    return Error::invalidData("tree too deep");
+            } else if (type == Token::END_NODE) {
+                if (depth == 0)
+                    return Error::invalidData("unbalanced end node");
+                hasChildren = true;
+                depth--;
+            } else if (type == Token::PROP) {
+                if (depth == 0)
+                    return Error::invalidData("property outside of node");
+                if (hasChildren)
+                    return Error::invalidData("property after child node");
+                if (tokens.rem() < 2 * sizeof(u32))
+                    return Error::invalidData("truncated property");
+                usize len = tokens.nextU32be();
+                usize nameoff = tokens.nextU32be();
+                if (nameoff >= strings.len() or not _hasNul(sub(strings, nameoff, strings.len())))
+                    return Error::invalidData("invalid property name offset");
+                if (_align4(len) > tokens.rem())
+                    return Error::invalidData("property out of bounds");
+                tokens.skip(_align4(len));
+            } else if (type == Token::NOP) {
+                continue;
+            } else if (type == Token::END) {
+                if (depth != 0)
+                    return Error::invalidData("unterminated node");
+                if (not root)
+                    return Error::invalidData("missing root node");
+                break;
+            } else {
+                return Error::invalidData("invalid token");
+            }
+        }
+
+        _validated = true;
+        return Ok();
     }
 
     Node root() const {
         return Node{iterTokens(), InheritedProperties{}};
     }
 
+    // An index of the whole tree, built on first use. A blob that fails to
+    // index gets an empty one, and lookups through it find nothing.
+    Index index() const {
+        if (not _index) {
+            _IndexStorage storage;
+            auto size = Index::measure(*this);
+            storage.nodes.resize(size.nodes);
+            storage.props.resize(size.props);
+            storage.phandles.resize(size.phandles);
+            storage.names.resize(size.nodes);
+            if (not Index::build(*this, storage.arena()))
+                storage = {};
+            _index = std::move(storage);
+        }
+
+        auto& storage = _index.unwrap();
+        return {
+            stringsBlock(),
+            structureBlock(),
+            {storage.nodes.buf(), storage.nodes.len()},
+            {storage.props.buf(), storage.props.len()},
+            {storage.phandles.buf(), storage.phandles.len()},
+            {storage.names.buf(), storage.names.len()},
+        };
+    }
+
+    usize _offsetOf(Node const& node) const {
+        return structureBlock().len() - node._tokens.tokens.rem();
+    }
+
+    Opt<Node> byPhandle(u32 phandle) const {
+        auto idx = index();
+        return Some(idx.node(try$(idx.byPhandle(phandle))));
+    }
+
+    Opt<Node> parentOf(Node const& node) const {
+        auto idx = index();
+        auto parent = idx[try$(idx.indexOf(node))].parent;
+        if (parent == IndexNode::NIL)
+            return NONE;
+        return Some(idx.node(parent));
+    }
+
+    // https://devicetree-specification.readthedocs.io/en/stable/devicetree-basics.html#interrupts-and-interrupt-mapping
+    Opt<Node> interruptParent(Node const& node) const {
+        auto curr = node;
+        // Walk until we reach a node that can take an interrupt specifier,
+        // either an interrupt controller or an interrupt nexus.
+        for (usize depth = 0; depth < MAX_INTERRUPT_DEPTH; depth++) {
+            if (auto [phandle] = curr.getProperty<u32be>("interrupt-parent"))
+                curr = try$(byPhandle(phandle));
+            else
+                curr = try$(parentOf(curr));
+
+            if (curr.getProperty("#interrupt-cells"))
+                return Some(curr);
+        }
+        return NONE;
+    }
+
+    Opt<Interrupt> _resolveInterrupt(Node device, Node parent, Slice<u32be> specifier) const {
+        Slice<u32be> unitAddr = {};
+        if (auto [reg] = device.getProperty("reg"))
+            unitAddr = reg.cells();
+
+        auto curr = parent;
+        for (usize depth = 0; depth < MAX_INTERRUPT_DEPTH; depth++) {
+            if (curr.getProperty("interrupt-controller"))
+                return Some(Interrupt{curr, specifier});
+
+            auto map = curr.getProperty("interrupt-map");
+            if (not map) {
+                // Neither a controller nor a nexus, keep going up.
+                curr = try$(interruptParent(curr));
+                continue;
+            }
+
+            usize addressCells = curr._inherited.addressCells;
+            usize interruptCells = curr._inherited.interruptCells;
+
+            Slice<u32be> mask = {};
+            if (auto [maskProp] = curr.getProperty("interrupt-map-mask"))
+                mask = maskProp.cells();
+
+            auto masked = [&](usize i, u32 value) -> u32 {
+                if (i >= mask.len())
+                    return value;
+                return value & mask[i];
+            };
+
+            auto entries = map->cells();
+            bool found = false;
+            usize i = 0;
+            while (i + addressCells + interruptCells < entries.len()) {
+                auto childAddr = sub(entries, i, i + addressCells);
+                auto childSpec = sub(entries, i + addressCells, i + addressCells + interruptCells);
+                i += addressCells + interruptCells;
+
+                auto next = try$(byPhandle(entries[i++]));
+                // The parent unit address is only present if the parent
+                // explicitly declares #address-cells.
+                usize nextAddressCells = 0;
+                if (auto [cells] = next.getProperty<u32be>("#address-cells"))
+                    nextAddressCells = cells;
+                usize nextInterruptCells = next._inherited.interruptCells;
+                if (i + nextAddressCells + nextInterruptCells > entries.len())
+                    return NONE;
+                auto nextAddr = sub(entries, i, i + nextAddressCells);
+                auto nextSpec = sub(entries, i + nextAddressCells, i + nextAddressCells + nextInterruptCells);
+                i += nextAddressCells + nextInterruptCells;
+
+                bool match = true;
+                for (usize j = 0; match and j < addressCells; j++)
+                    match = masked(j, _cellAt(unitAddr, j)) == childAddr[j];
+                for (usize j = 0; match and j < interruptCells; j++)
+                    match = masked(addressCells + j, _cellAt(specifier, j)) == childSpec[j];
+
+                if (match) {
+                    curr = next;
+                    unitAddr = nextAddr;
+                    specifier = nextSpec;
+                    found = true;
+                    break;
+                }
+            }
+
+            if (not found)
+                return NONE;
+        }
+        return NONE;
+    }
+
+    // Resolve the index-th interrupt of a device, following
+    // interrupts-extended or interrupt-parent and any interrupt-map
+    // on the way to the actual controller.
+    Opt<Interrupt> interrupt(Node const& device, usize index) const {
+        if (auto [extended] = device.getProperty("interrupts-extended")) {
+            auto cells = extended.cells();
+            usize i = 0;
+            for (usize n = 0; i < cells.len(); n++) {
+                auto parent = try$(byPhandle(cells[i++]));
+                usize len = parent._inherited.interruptCells;
+                if (i + len > cells.len())
+                    return NONE;
+                if (n == index)
+                    return _resolveInterrupt(device, parent, sub(cells, i, i + len));
+                i += len;
+            }
+            return NONE;
+        }
+
+        auto interrupts = try$(device.getProperty("interrupts")).cells();
+        auto parent = try$(interruptParent(device));
+        usize len = parent._inherited.interruptCells;
+        if (len == 0 or (index + 1) * len > interrupts.len())
+            return NONE;
+        return _resolveInterrupt(device, parent, sub(interrupts, index * len, (index + 1) * len));
+    }
+
+    Opt<RangesIter> _iterRanges(Node const& bus, Node const& parent, Str prop) const {
+        auto ranges = try$(bus.getProperty(prop));
+        return Some(RangesIter{
+            ranges.cells(),
+            bus._inherited.addressCells,
+            parent._inherited.addressCells,
+            bus._inherited.sizeCells,
+        });
+    }
+
+    // Translate an address from the bus a node sits on up to the CPU
+    // physical address space, through each `ranges` (or `dma-ranges`) on
+    // the way. A missing property means the bus is not translatable, an
+    // empty one is an identity mapping.
+    Opt<u64> translate(Node const& node, u64 addr, Str prop = "ranges") const {
+        auto bus = try$(parentOf(node));
+        while (auto parent = parentOf(bus)) {
+            auto ranges = try$(_iterRanges(bus, *parent, prop));
+            if (ranges.cells.len()) {
+                bool found = false;
+                for (auto window : ranges) {
+                    if (window.contains(addr)) {
+                        addr = window.translate(addr);
+                        found = true;
+                        break;
+                    }
+                }
+                if (not found)
+                    return NONE;
+            }
+            bus = *parent;
+        }
+        return Some(addr);
+    }
+
+    Opt<u64> translateDma(Node const& node, u64 addr) const {
+        return translate(node, addr, "dma-ranges");
+    }
+
+    // Substitute a leading alias with the path it stands for.
+    Opt<Query> _resolveAlias(Query const& query) const {
+        if (not query._alias)
+            return Some(query);
+
+        auto aliases = try$(root().findChildren("aliases"));
+        auto alias = try$(aliases.getProperty(query._alias));
+        if (not alias.raw().len())
+            return NONE;
+        Str path = sub(alias.raw(), 0, alias.raw().len() - 1).cast<char>();
+
+        auto resolved = try$(Query::compile(path).ok());
+        if (resolved._alias)
+            return NONE;
+        for (auto const& c : query.components()) {
+            if (resolved._len >= Query::MAX_COMPONENTS)
+                return NONE;
+            resolved._components[resolved._len++] = c;
+        }
+        return Some(resolved);
+    }
+
+    QueryIter query(Query const& query) const {
+        auto resolved = _resolveAlias(query);
+        return QueryIter{
+            ._query = resolved.unwrapOr(Query{}),
+            ._tokens = iterTokens(),
+            ._ended = not resolved,
+        };
+    }
+
+    Opt<Node> find(Query const& query) const {
+        return this->query(query).next();
+    }
+
+    Opt<Node> find(Str path) const {
+        auto query = try$(Query::compile(path).ok());
+        return find(query);
+    }
+
     Opt<Range<u64>> initrd() const {
         auto chosenNode = try$(root().findChildren("chosen"));
         auto initrdStart = try$(chosenNode.getProperty<u64be>("linux,initrd-start"));
@@ -556,4 +1383,1214 @@ export struct Blob : Io::BChunk {
     }
 };
 
+// MARK: Index building --------------------------------------------------------
+
+Index::Size Index::measure(Blob const& blob) {
+    Size size;
+    auto tokens = blob.iterTokens();
+    while (auto token = tokens.next()) {
+        if (token->type == Token::BEGIN_NODE)
+            size.nodes++;
+        else if (token->type == Token::PROP) {
+            size.props++;
+            if (_isPhandle(token->fullname, token->extra))
+                size.phandles++;
+        }
+    }
+    return size;
+}
+
+Res<Index> Index::build(Blob const& blob, Arena arena) {
+    auto& nodes = arena.nodes;
+    auto& props = arena.props;
+    auto& phandles = arena.phandles;
+    auto& names = arena.names;
+
+    usize nodeLen = 0;
+    usize propLen = 0;
+    usize phandleLen = 0;
+
+    u32 curr = IndexNode::NIL;
+    u32 lastClosed = IndexNode::NIL;
+
+    auto tokens = blob.iterTokens();
+    while (true) {
+        usize offset = tokens.tokens.tell();
+        auto maybeToken = tokens.next();
+        if (not maybeToken)
+            break;
+        auto token = maybeToken.unwrap();
+
+        if (token.type == Token::BEGIN_NODE) {
+            if (nodeLen >= nodes.len() or nodeLen >= names.len())
+                return Error::outOfMemory("index node arena too small");
+
+            u32 index = nodeLen++;
+            auto& node = nodes[index];
+            node = {};
+            node.offset = offset;
+            node.fullname = token.fullname;
+            node.firstProp = propLen;
+
+            if (curr != IndexNode::NIL) {
+                auto& parent = nodes[curr];
+                node.parent = curr;
+                node.inherited = parent.inherited;
+                if (parent.firstChild == IndexNode::NIL)
+                    parent.firstChild = index;
+                else
+                    nodes[lastClosed].nextSibling = index;
+            } else if (index != 0) {
+                return Error::invalidData("multiple root nodes");
+            }
+
+            names[index] = {_hashStr(token.name()), index};
+            curr = index;
+        } else if (token.type == Token::END_NODE) {
+            if (curr == IndexNode::NIL)
+                return Error::invalidData("unbalanced end node");
+            nodes[curr].end = nodeLen;
+            lastClosed = curr;
+            curr = nodes[curr].parent;
+        } else if (token.type == Token::PROP) {
+            if (curr == IndexNode::NIL)
+                return Error::invalidData("property outside of node");
+
+            auto& node = nodes[curr];
+            if (node.firstChild != IndexNode::NIL)
+                return Error::invalidData("property after child node");
+
+            if (propLen >= props.len())
+                return Error::outOfMemory("index property arena too small");
+
+            props[propLen++] = {token.fullname, token.extra};
+            node.propLen++;
+            _inheritCells(node.inherited, token.fullname, token.extra);
+
+            if (_isPhandle(token.fullname, token.extra)) {
+                if (phandleLen >= phandles.len())
+                    return Error::outOfMemory("index phandle arena too small");
+                phandles[phandleLen++] = {token.extra.cast<u32be>()[0], curr};
+            }
+        }
+    }
+
+    if (curr != IndexNode::NIL)
+        return Error::invalidData("unterminated node");
+
+    auto sortedPhandles = sub(phandles, 0, phandleLen);
+    sort(sortedPhandles);
+
+    auto sortedNames = sub(names, 0, nodeLen);
+    sort(sortedNames);
+
+    return Ok(Index{
+        blob.stringsBlock(),
+        blob.structureBlock(),
+        sub(nodes, 0, nodeLen),
+        sub(props, 0, propLen),
+        sortedPhandles,
+        sortedNames,
+    });
+}
+
+// MARK: Matcher ---------------------------------------------------------------
+
+export struct Match {
+    usize driver;
+    Node node;
+};
+
+// Match a set of drivers against the tree by their compatible strings,
+// all of them at once in a single pass over the structure block.
+export struct Matcher {
+    struct Pattern {
+        u32 hash;
+        u32 driver;
+        Str compatible;
+
+        auto operator<=>(Pattern const& other) const {
+            if (hash != other.hash)
+                return hash <=> other.hash;
+            return driver <=> other.driver;
+        }
+    };
+
+    Vec<Pattern> _patterns;
+    bool _dirty = false;
+
+    void add(usize driver, Str compatible) {
+        _patterns.pushBack({_hashStr(compatible), static_cast<u32>(driver), compatible});
+        _dirty = true;
+    }
+
+    void add(usize driver, Slice<Str> compatibles) {
+        for (auto compatible : compatibles)
+            add(driver, compatible);
+    }
+
+    void _prepare() {
+        if (not _dirty)
+            return;
+        sort(_patterns);
+        _dirty = false;
+    }
+
+    Opt<usize> _lookup(Str compatible) const {
+        u32 hash = _hashStr(compatible);
+        usize lo = 0, hi = _patterns.len();
+        while (lo < hi) {
+            usize mid = lo + (hi - lo) / 2;
+            if (_patterns[mid].hash < hash)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        for (usize i = lo; i < _patterns.len() and _patterns[i].hash == hash; i++) {
+            if (_patterns[i].compatible == compatible)
+                return Some<usize>(_patterns[i].driver);
+        }
+        return NONE;
+    }
+
+    // Compatible lists go from the most to the least specific, so the
+    // first entry that has a driver wins.
+    Opt<usize> _lookupList(Prop const& compatible) const {
+        for (auto str : compatible.iterStr()) {
+            if (auto driver = _lookup(str))
+                return driver;
+        }
+        return NONE;
+    }
+
+    Opt<usize> match(Node const& node) {
+        _prepare();
+        auto compatible = try$(node.getProperty("compatible"));
+        return _lookupList(compatible);
+    }
+
+    // Calls `f` with every (driver, node) pair, in probe order.
+    template <typename F>
+    void match(Blob const& blob, F&& f) {
+        _prepare();
+
+        Vec<InheritedProperties> stack;
+        auto tokens = blob.iterTokens();
+        TokenIter node = tokens;
+        Opt<usize> found = NONE;
+
+        auto flush = [&] {
+            if (not found)
+                return;
+            f(Match{found.unwrap(), Node::resolved(node, last(stack))});
+            found = NONE;
+        };
+
+        while (true) {
+            auto before = tokens;
+            auto token = tokens.next();
+            if (not token)
+                break;
+
+            if (token->type == Token::BEGIN_NODE) {
+                flush();
+                stack.pushBack(stack.len() ? last(stack) : InheritedProperties{});
+                node = before;
+            } else if (token->type == Token::END_NODE) {
+                flush();
+                if (stack.len())
+                    stack.popBack();
+            } else if (token->type == Token::PROP and stack.len()) {
+                _inheritCells(stack[stack.len() - 1], token->fullname, token->extra);
+                if (token->fullname == "compatible")
+                    found = _lookupList(Prop{token.unwrap(), {}});
+            }
+        }
+    }
+
+    Vec<Match> match(Blob const& blob) {
+        Vec<Match> matches;
+        match(blob, [&](Match m) {
+            matches.pushBack(m);
+        });
+        return matches;
+    }
+};
+
+// MARK: Translator ------------------------------------------------------------
+
+// Caches, for each bus, its windows flattened all the way down to the CPU
+// physical address space so that translating an address is a single lookup.
+// Works on an Index, with one bus slot per node of the index, and all the
+// storage supplied by the caller, so nothing is allocated.
+export struct Translator {
+    struct Bus {
+        u32 first = 0;
+        u32 len = 0;
+        bool resolved = false;
+        bool failed = false;
+        bool identity = false;
+    };
+
+    Index const& _index;
+    Str _prop;
+    MutSlice<Bus> _buses; // Indexed like the nodes of the index
+    MutSlice<Window> _windows;
+    usize _windowLen = 0;
+
+    Translator(Index const& index, MutSlice<Bus> buses, MutSlice<Window> windows, Str prop = "ranges")
+        : _index(index), _prop(prop), _buses(buses), _windows(windows) {
+        for (auto& bus : _buses)
+            bus = {};
+    }
+
+    // Failures are cached too, so that a bus with broken ranges isn't
+    // parsed again on every lookup.
+    Opt<Bus> _resolve(u32 bus) {
+        if (bus >= _buses.len() or _buses[bus].failed)
+            return NONE;
+        if (_buses[bus].resolved)
+            return Some(_buses[bus]);
+
+        auto result = _flatten(bus);
+        if (not result) {
+            _buses[bus].failed = true;
+            return NONE;
+        }
+        return Some(_buses[bus] = result.unwrap());
+    }
+
+    Opt<Bus> _flatten(u32 bus) {
+        Bus result{.resolved = true};
+
+        u32 parent = _index[bus].parent;
+        if (parent == IndexNode::NIL) {
+            result.identity = true;
+            return Some(result);
+        }
+
+        auto ranges = RangesIter{
+            try$(_index.getProperty(bus, _prop)).cells(),
+            _index[bus].inherited.addressCells,
+            _index[parent].inherited.addressCells,
+            _index[bus].inherited.sizeCells,
+        };
+        auto parentBus = try$(_resolve(parent));
+
+        if (not ranges.cells.len()) {
+            result.first = parentBus.first;
+            result.len = parentBus.len;
+            result.identity = parentBus.identity;
+            return Some(result);
+        }
+
+        result.first = _windowLen;
+        for (auto window : ranges) {
+            if (not _pushFlattened(window, parentBus)) {
+                // Only this bus' windows are past `first`, its parents were
+                // flattened before.
+                _windowLen = result.first;
+                return NONE;
+            }
+        }
+        result.len = _windowLen - result.first;
+        return Some(result);
+    }
+
+    bool _pushFlattened(Window window, Bus parentBus) {
+        if (parentBus.identity)
+            return bool(_pushWindow(window));
+
+        // Intersect the window with each of the already flattened windows
+        // of the parent bus.
+        for (auto const& p : sub(_windows, parentBus.first, parentBus.first + parentBus.len)) {
+            u64 start = max(window.parent, p.child);
+            u64 end = min(window.parent + window.size, p.child + p.size);
+            if (start >= end)
+                continue;
+            bool pushed = bool(_pushWindow({
+                window.child + (start - window.parent),
+                p.translate(start),
+                end - start,
+            }));
+            if (not pushed)
+                return false;
+        }
+        return true;
+    }
+
+    Opt<usize> _pushWindow(Window window) {
+        if (_windowLen >= _windows.len())
+            return NONE;
+        _windows[_windowLen] = window;
+        return Some(_windowLen++);
+    }
+
+    // The bus a node sits on.
+    Opt<Bus> _busOf(u32 node) {
+        if (node >= _index.len() or _index[node].parent == IndexNode::NIL)
+            return NONE;
+        return _resolve(_index[node].parent);
+    }
+
+    // The flattened windows of the bus `node` sits on.
+    Opt<Slice<Window>> windows(u32 node) {
+        auto bus = try$(_busOf(node));
+        return Some(Slice<Window>{sub(_windows, bus.first, bus.first + bus.len)});
+    }
+
+    Opt<Slice<Window>> windows(Node const& node) {
+        return windows(try$(_index.indexOf(node)));
+    }
+
+    Opt<u64> translate(u32 node, u64 addr) {
+        auto bus = try$(_busOf(node));
+        if (bus.identity)
+            return Some(addr);
+        for (auto const& window : sub(_windows, bus.first, bus.first + bus.len)) {
+            if (window.contains(addr))
+                return Some(window.translate(addr));
+        }
+        return NONE;
+    }
+
+    Opt<u64> translate(Node const& node, u64 addr) {
+        return translate(try$(_index.indexOf(node)), addr);
+    }
+};
+
+// MARK: Writer ----------------------------------------------------------------
+
+static Bytes _bytesOf(Str str) {
+    return {reinterpret_cast<u8 const*>(str.buf()), str.len()};
+}
+
+static void _moveBytes(u8* dst, u8 const* src, usize len) {
+    if (dst < src) {
+        for (usize i = 0; i < len; i++)
+            dst[i] = src[i];
+    } else {
+        for (usize i = len; i > 0; i--)
+            dst[i - 1] = src[i - 1];
+    }
+}
+
+// Streams a flattened device tree into a caller supplied buffer.
+//
+// The structure block grows up from the header while the strings block
+// grows down from the end of the buffer, both are stitched together
+// by finish().
+export struct Writer {
+    MutBytes _buf;
+    usize _head = sizeof(Header);
+    usize _structure = 0;
+    usize _strings;
+    usize _depth = 0;
+
+    Writer(MutBytes buf)
+        : _buf(buf), _strings(buf.len()) {}
+
+    template <typename T>
+    T& _at(usize offset) {
+        return *reinterpret_cast<T*>(_buf.buf() + offset);
+    }
+
+    Res<> _ensure(usize len) {
+        if (_head + len > _strings)
+            return Error::outOfMemory("dtb buffer too small");
+        return Ok();
+    }
+
+    Res<> _u32(u32 value) {
+        try$(_ensure(sizeof(u32be)));
+        _at<u32be>(_head) = value;
+        _head += sizeof(u32be);
+        return Ok();
+    }
+
+    Res<> _raw(Bytes bytes) {
+        try$(_ensure(bytes.len()));
+        _moveBytes(_buf.buf() + _head, bytes.buf(), bytes.len());
+        _head += bytes.len();
+        return Ok();
+    }
+
+    Res<> _nul() {
+        try$(_ensure(1));
+        _buf[_head++] = 0;
+        return Ok();
+    }
+
+    Res<> _pad() {
+        usize len = _align4(_head) - _head;
+        try$(_ensure(len));
+        for (usize i = 0; i < len; i++)
+            _buf[_head++] = 0;
+        return Ok();
+    }
+
+    Res<> _cstr(Str str) {
+        try$(_raw(_bytesOf(str)));
+        try$(_nul());
+        return _pad();
+    }
+
+    // Strings are referenced by their distance from the end of the buffer
+    // until finish() knows where the strings block starts.
+    Res<u32> _string(Str str) {
+        for (usize i = _strings; i + str.len() < _buf.len(); i++) {
+            if (_buf[i + str.len()] == 0 and
+                Str{reinterpret_cast<char const*>(_buf.buf() + i), str.len()} == str)
+                return Ok<u32>(_buf.len() - i);
+        }
+
+        if (_strings < _head + str.len() + 1)
+            return Error::outOfMemory("dtb buffer too small");
+
+        _strings -= str.len() + 1;
+        _moveBytes(_buf.buf() + _strings, _bytesOf(str).buf(), str.len());
+        _buf[_strings + str.len()] = 0;
+        return Ok<u32>(_buf.len() - _strings);
+    }
+
+    Res<> reserve(u64 address, u64 size) {
+        if (_structure)
+            return Error::invalidInput("reservations must come before nodes");
+        try$(_ensure(sizeof(ReserveEntry)));
+        auto& entry = _at<ReserveEntry>(_head);
+        entry.address = address;
+        entry.size = size;
+        _head += sizeof(ReserveEntry);
+        return Ok();
+    }
+
+    Res<> _beginStructure() {
+        if (_structure)
+            return Ok();
+        try$(reserve(0, 0));
+        _structure = _head;
+        return Ok();
+    }
+
+    Res<> beginNode(Str name) {
+        try$(_beginStructure());
+        if (_depth == 0 and _head != _structure)
+            return Error::invalidInput("multiple root nodes");
+        try$(_u32(static_cast<u32>(Token::BEGIN_NODE)));
+        try$(_cstr(name));
+        _depth++;
+        return Ok();
+    }
+
+    Res<> endNode() {
+        if (_depth == 0)
+            return Error::invalidInput("no node to end");
+        try$(_u32(static_cast<u32>(Token::END_NODE)));
+        _depth--;
+        return Ok();
+    }
+
+    Res<> _propHeader(Str name, usize len) {
+        if (_depth == 0)
+            return Error::invalidInput("property outside of node");
+        auto nameoff = try$(_string(name));
+        try$(_u32(static_cast<u32>(Token::PROP)));
+        try$(_u32(len));
+        return _u32(nameoff);
+    }
+
+    Res<> prop(Str name, Bytes value = {}) {
+        try$(_propHeader(name, value.len()));
+        try$(_raw(value));
+        return _pad();
+    }
+
+    Res<> prop(Str name, u32 value) {
+        u32be be = value;
+        return prop(name, Bytes{reinterpret_cast<u8 const*>(&be), sizeof(be)});
+    }
+
+    Res<> prop(Str name, u64 value) {
+        u64be be = value;
+        return prop(name, Bytes{reinterpret_cast<u8 const*>(&be), sizeof(be)});
+    }
+
+    Res<> prop(Str name, Str value) {
+        try$(_propHeader(name, value.len() + 1));
+        return _cstr(value);
+    }
+
+    Res<> prop(Str name, Slice<Str> values) {
+        usize len = 0;
+        for (auto value : values)
+            len += value.len() + 1;
+        try$(_propHeader(name, len));
+        for (auto value : values) {
+            try$(_raw(_bytesOf(value)));
+            try$(_nul());
+        }
+        return _pad();
+    }
+
+    Res<Bytes> finish(u32 bootCpuid = 0) {
+        try$(_beginStructure());
+        if (_depth)
+            return Error::invalidInput("unterminated node");
+        try$(_u32(static_cast<u32>(Token::END)));
+
+        usize structureSize = _head - _structure;
+        usize stringsSize = _buf.len() - _strings;
+
+        // Now that the strings block is complete, turn the name offsets
+        // into offsets from its start.
+        usize off = _structure;
+        while (off < _head) {
+            auto type = static_cast<Token::Type>(static_cast<u32>(_at<u32be>(off)));
+            off += sizeof(u32be);
+            if (type == Token::BEGIN_NODE) {
+                while (_buf[off] != 0)
+                    off++;
+                off = _align4(off + 1);
+            } else if (type == Token::PROP) {
+                u32 len = _at<u32be>(off);
+                auto& nameoff = _at<u32be>(off + sizeof(u32be));
+                nameoff = stringsSize - nameoff;
+                off += 2 * sizeof(u32be) + _align4(len);
+            }
+        }
+
+        _moveBytes(_buf.buf() + _head, _buf.buf() + _strings, stringsSize);
+
+        auto& header = _at<Header>(0);
+        header.magic = MAGIC;
+        header.totalSize = _head + stringsSize;
+        header.structureBlockOffset = _structure;
+        header.stringsBlockOffset = _head;
+        header.memoryReservationBlockOffset = sizeof(Header);
+        header.version = VERSION;
+        header.lastCompatibleVersion = LAST_COMPATIBLE_VERSION;
+        header.bootCpuidPhys = bootCpuid;
+        header.stringsBlockSize = stringsSize;
+        header.structureBlockSize = structureSize;
+
+        return Ok(Bytes{_buf.buf(), _head + stringsSize});
+    }
+};
+
+// MARK: Patcher ---------------------------------------------------------------
+
+// Extra room left behind as NOPs whenever the patcher has to move the tail
+// of the blob, so that the next few patches can be done in place.
+static constexpr usize PATCH_SLACK = 64;
+
+// Edits a blob in place, the buffer may be larger than the blob to leave
+// room for it to grow. Expects the usual layout of header, reservations,
+// structure and strings blocks in that order.
+export struct Patcher {
+    MutBytes _buf;
+
+    static Res<Patcher> open(MutBytes buf) {
+        if (buf.len() < sizeof(Header))
+            return Error::invalidData("data too small");
+
+        auto header = Io::BScan{buf}.next<Header>();
+        if (header.totalSize > buf.len())
+            return Error::invalidData("total size larger than buffer");
+
+        // The patcher walks tokens and strings without bounds checks.
+        auto blob = try$(Blob::open(sub(buf, 0, header.totalSize)));
+        try$(blob.validate());
+
+        if (header.memoryReservationBlockOffset > header.structureBlockOffset or
+            header.structureBlockOffset + header.structureBlockSize > header.stringsBlockOffset or
+            header.stringsBlockOffset + header.stringsBlockSize != header.totalSize)
+            return Error::invalidData("unsupported block layout");
+
+        return Ok(Patcher{buf});
+    }
+
+    template <typename T>
+    T& _at(usize offset) {
+        return *reinterpret_cast<T*>(_buf.buf() + offset);
+    }
+
+    Header& header() {
+        return _at<Header>(0);
+    }
+
+    Blob blob() {
+        return Blob::open(sub(_buf, 0, header().totalSize)).unwrap();
+    }
+
+    Res<> _grow(usize at, usize len) {
+        auto& h = header();
+        usize total = h.totalSize;
+        if (total + len > _buf.len())
+            return Error::outOfMemory("dtb buffer too small");
+
+        _moveBytes(_buf.buf() + at + len, _buf.buf() + at, total - at);
+
+        usize structure = h.structureBlockOffset;
+        usize structureEnd = structure + h.structureBlockSize;
+        if (at > structure and at <= structureEnd)
+            h.structureBlockSize = h.structureBlockSize + len;
+        else if (structure >= at)
+            h.structureBlockOffset = structure + len;
+
+        if (h.stringsBlockOffset >= at)
+            h.stringsBlockOffset = h.stringsBlockOffset + len;
+
+        h.totalSize = total + len;
+        return Ok();
+    }
+
+    void _nops(usize at, usize len) {
+        for (usize i = 0; i < len; i += sizeof(u32be))
+            _at<u32be>(at + i) = static_cast<u32>(Token::NOP);
+    }
+
+    bool _isNop(usize at) {
+        auto& h = header();
+        return at < h.structureBlockOffset + h.structureBlockSize and
+               static_cast<u32>(_at<u32be>(at)) == static_cast<u32>(Token::NOP);
+    }
+
+    // Make sure `need` bytes are available at `at`, where `have` bytes are
+    // already free. Following NOPs are reused before moving the tail.
+    // Returns how many bytes are actually available.
+    Res<usize> _makeRoom(usize at, usize have, usize need) {
+        while (have < need and _isNop(at + have))
+            have += sizeof(u32be);
+
+        if (have >= need)
+            return Ok(have);
+
+        usize missing = need - have;
+        auto& h = header();
+        usize grow = missing + PATCH_SLACK;
+        if (h.totalSize + grow > _buf.len())
+            grow = missing;
+        try$(_grow(at + have, grow));
+        return Ok(have + grow);
+    }
+
+    Res<u32> _string(Str str) {
+        auto& h = header();
+        usize strings = h.stringsBlockOffset;
+        usize size = h.stringsBlockSize;
+
+        for (usize i = 0; i + str.len() < size; i++) {
+            if (_buf[strings + i + str.len()] == 0 and
+                Str{reinterpret_cast<char const*>(_buf.buf() + strings + i), str.len()} == str)
+                return Ok<u32>(i);
+        }
+
+        if (h.totalSize + str.len() + 1 > _buf.len())
+            return Error::outOfMemory("dtb buffer too small");
+
+        usize at = strings + size;
+        _moveBytes(_buf.buf() + at, _bytesOf(str).buf(), str.len());
+        _buf[at + str.len()] = 0;
+        h.stringsBlockSize = size + str.len() + 1;
+        h.totalSize = h.totalSize + str.len() + 1;
+        return Ok<u32>(size);
+    }
+
+    Res<usize> _findNode(Str path) {
+        auto dtb = blob();
+        auto node = dtb.root();
+        Io::SScan s{path};
+        while (not s.ended()) {
+            s.skip(Re::zeroOrMore('/'_re));
+            auto component = s.token(Re::until('/'_re));
+            if (not component)
+                continue;
+
+            Opt<Node> found = NONE;
+            for (auto child : node.iterChildren()) {
+                if (child.fullname() == component or child.name() == component) {
+                    found = child;
+                    break;
+                }
+            }
+            if (not found)
+                return Error::notFound("node not found");
+            node = found.unwrap();
+        }
+        return Ok(header().structureBlockOffset + dtb._offsetOf(node));
+    }
+
+    struct _PropSlot {
+        usize at;
+        usize len;
+    };
+
+    // Find the property named `name` in the node at `node`, or where a new
+    // one should go.
+    _PropSlot _findProp(usize node, Str name) {
+        auto& h = header();
+        usize off = node + sizeof(u32be);
+        while (_buf[off] != 0)
+            off++;
+        off = _align4(off + 1);
+
+        Opt<usize> firstNop = NONE;
+        while (true) {
+            u32 type = _at<u32be>(off);
+            if (type == static_cast<u32>(Token::PROP)) {
+                u32 len = _at<u32be>(off + sizeof(u32be));
+                u32 nameoff = _at<u32be>(off + 2 * sizeof(u32be));
+                usize size = 3 * sizeof(u32be) + _align4(len);
+                auto propName = Io::BScan{sub(_buf, h.stringsBlockOffset, h.totalSize)}.skip(nameoff).nextCStr();
+                if (propName == name)
+                    return {off, size};
+                firstNop = NONE;
+                off += size;
+            } else if (type == static_cast<u32>(Token::NOP)) {
+                if (not firstNop)
+                    firstNop = off;
+                off += sizeof(u32be);
+            } else {
+                break;
+            }
+        }
+        return {firstNop.unwrapOr(off), 0};
+    }
+
+    // `len` may be larger than the value, the rest is zero filled.
+    Res<> _setProp(Str path, Str name, Bytes value, usize len) {
+        // Interning the name grows the blob, only do it once the node is
+        // known to exist. It doesn't move the structure block.
+        auto node = try$(_findNode(path));
+        auto nameoff = try$(_string(name));
+        auto slot = _findProp(node, name);
+
+        usize need = 3 * sizeof(u32be) + _align4(len);
+        usize have = try$(_makeRoom(slot.at, slot.len, need));
+
+        _at<u32be>(slot.at) = static_cast<u32>(Token::PROP);
+        _at<u32be>(slot.at + sizeof(u32be)) = len;
+        _at<u32be>(slot.at + 2 * sizeof(u32be)) = nameoff;
+        usize data = slot.at + 3 * sizeof(u32be);
+        _moveBytes(_buf.buf() + data, value.buf(), value.len());
+        for (usize i = data + value.len(); i < slot.at + need; i++)
+            _buf[i] = 0;
+        _nops(slot.at + need, have - need);
+        return Ok();
+    }
+
+    Res<> setProp(Str path, Str name, Bytes value = {}) {
+        return _setProp(path, name, value, value.len());
+    }
+
+    Res<> setProp(Str path, Str name, u32 value) {
+        u32be be = value;
+        return setProp(path, name, Bytes{reinterpret_cast<u8 const*>(&be), sizeof(be)});
+    }
+
+    Res<> setProp(Str path, Str name, u64 value) {
+        u64be be = value;
+        return setProp(path, name, Bytes{reinterpret_cast<u8 const*>(&be), sizeof(be)});
+    }
+
+    Res<> setProp(Str path, Str name, Str value) {
+        return _setProp(path, name, _bytesOf(value), value.len() + 1);
+    }
+
+    Res<> removeProp(Str path, Str name) {
+        auto node = try$(_findNode(path));
+        auto slot = _findProp(node, name);
+        if (not slot.len)
+            return Error::notFound("property not found");
+        _nops(slot.at, slot.len);
+        return Ok();
+    }
+
+    Res<> reserve(u64 address, u64 size) {
+        usize off = header().memoryReservationBlockOffset;
+        while (_at<ReserveEntry>(off))
+            off += sizeof(ReserveEntry);
+
+        try$(_grow(off, sizeof(ReserveEntry)));
+        auto& entry = _at<ReserveEntry>(off);
+        entry.address = address;
+        entry.size = size;
+        return Ok();
+    }
+};
+
+// MARK: Emitters --------------------------------------------------------------
+
+// Emit a quoted string, escaped the same way for JSON and DTS.
+static void _emitQuoted(Io::Emit& e, Str str) {
+    e("\"");
+    usize start = 0;
+    for (usize i = 0; i < str.len(); i++) {
+        char c = str[i];
+        if (c != '"' and c != '\\' and static_cast<u8>(c) >= 0x20)
+            continue;
+        e("{}", Str{str.buf() + start, i - start});
+        if (c == '"')
+            e("\\\"");
+        else if (c == '\\')
+            e("\\\\");
+        else
+            e("\\u{:04x}", static_cast<u8>(c));
+        start = i + 1;
+    }
+    e("{}", Str{str.buf() + start, str.len() - start});
+    e("\"");
+}
+
+static void _emitJsonValue(Io::Emit& e, Prop const& prop) {
+    auto type = prop.sniff();
+    if (type == Prop::NIL) {
+        e("true");
+        return;
+    }
+
+    bool first = true;
+    auto sep = [&] {
+        if (not first)
+            e(", ");
+        first = false;
+    };
+
+    e("[");
+    if (type == Prop::STR) {
+        for (auto str : prop.iterStr()) {
+            sep();
+            _emitQuoted(e, str);
+        }
+    } else if (type == Prop::U32 or type == Prop::U64) {
+        for (u32 cell : prop.regs32()) {
+            sep();
+            e("{}", cell);
+        }
+    } else {
+        for (auto b : prop.raw()) {
+            sep();
+            e("{}", b);
+        }
+    }
+    e("]");
+}
+
+// Stream the tree as JSON in a single pass over the structure block.
+export void dumpJson(Blob const& blob, Io::Emit& e) {
+    static constexpr u8 PROPS_CLOSED = 1 << 0;
+    static constexpr u8 HAS_CHILD = 1 << 1;
+    static constexpr u8 HAS_PROP = 1 << 2;
+
+    Array<u8, MAX_DEPTH + 1> state = {};
+    usize depth = 0;
+
+    e("{");
+    e("\"version\": {}, \"bootCpuid\": {}, ", blob.header().version, blob.header().bootCpuidPhys);
+    e("\"reservations\": [");
+    bool first = true;
+    for (auto const& r : blob.memoryReservations()) {
+        if (not first)
+            e(", ");
+        first = false;
+        e("[{}, {}]", r.address, r.size);
+    }
+    e("], \"root\": ");
+
+    auto tokens = blob.iterTokens();
+    while (auto token = tokens.next()) {
+        if (token->type == Token::BEGIN_NODE) {
+            if (depth >= MAX_DEPTH)
+                break;
+            if (depth > 0) {
+                auto& parent = state[depth];
+                if (not(parent & PROPS_CLOSED)) {
+                    e("}, \"children\": [");
+                    parent |= PROPS_CLOSED;
+                } else if (parent & HAS_CHILD) {
+                    e(", ");
+                }
+                parent |= HAS_CHILD;
+            }
+            state[++depth] = 0;
+            e("{");
+            e("\"name\": ");
+            _emitQuoted(e, token->fullname);
+            e(", \"props\": {");
+        } else if (token->type == Token::PROP and depth > 0) {
+            auto& curr = state[depth];
+            if (curr & PROPS_CLOSED)
+                continue;
+            if (curr & HAS_PROP)
+                e(", ");
+            curr |= HAS_PROP;
+            _emitQuoted(e, token->fullname);
+            e(": ");
+            _emitJsonValue(e, Prop{token.unwrap(), {}});
+        } else if (token->type == Token::END_NODE and depth > 0) {
+            if (not(state[depth] & PROPS_CLOSED))
+                e("}, \"children\": [");
+            e("]");
+            e("}");
+            depth--;
+        }
+    }
+    e("}\n");
+}
+
+static void _emitDtsValue(Io::Emit& e, Prop const& prop) {
+    auto type = prop.sniff();
+    if (type == Prop::STR) {
+        e(" = ");
+        bool first = true;
+        for (auto str : prop.iterStr()) {
+            if (not first)
+                e(", ");
+            first = false;
+            _emitQuoted(e, str);
+        }
+    } else if (type == Prop::U32 or type == Prop::U64) {
+        e(" = <");
+        bool first = true;
+        for (u32 cell : prop.regs32()) {
+            if (not first)
+                e(" ");
+            first = false;
+            e("{:#x}", cell);
+        }
+        e(">");
+    } else if (type == Prop::BYTES) {
+        e(" = [");
+        bool first = true;
+        for (auto b : prop.raw()) {
+            if (not first)
+                e(" ");
+            first = false;
+            e("{:02x}", b);
+        }
+        e("]");
+    }
+}
+
+// Stream the tree as device tree source in a single pass over the
+// structure block.
+export void dumpDts(Blob const& blob, Io::Emit& e) {
+    e("/dts-v1/;\n\n");
+    for (auto const& r : blob.memoryReservations())
+        e("/memreserve/ {:#x} {:#x};\n", r.address, r.size);
+
+    usize depth = 0;
+    auto tokens = blob.iterTokens();
+    while (auto token = tokens.next()) {
+        if (token->type == Token::BEGIN_NODE) {
+            if (depth >= MAX_DEPTH)
+                break;
+            e("\n");
+            e("{}", token->fullname ? token->fullname : Str{"/"});
+            e(" {");
+            e.indentNewline();
+            depth++;
+        } else if (token->type == Token::PROP and depth > 0) {
+            e("{}", token->fullname);
+            _emitDtsValue(e, Prop{token.unwrap(), {}});
+            e(";\n");
+        } else if (token->type == Token::END_NODE and depth > 0) {
+            e.deindent();
+            e("};\n");
+            depth--;
+        }
+    }
+}
+
+// MARK: Schema ----------------------------------------------------------------
+
+// Declarative decoding of the properties a driver cares about:
+//
+//     struct Uart {
+//         AddressSizeCell reg;
+//         u32 clockFrequency;
+//         Opt<u32> regShift;
+//
+//         static constexpr auto SCHEMA = Dtb::Schema{
+//             Dtb::field("reg", &Uart::reg),
+//             Dtb::field("clock-frequency", &Uart::clockFrequency),
+//             Dtb::field("reg-shift", &Uart::regShift),
+//         };
+//     };
+//
+//     auto uart = try$(Dtb::decode<Uart>(node));
+//
+// Fields are filled in a single pass over the properties of the node, names
+// are matched by a hash computed at compile time. Opt<> and bool fields are
+// optional, everything else is required.
+
+export struct Phandle {
+    u32 value;
+};
+
+export struct StrList {
+    Str _str;
+
+    auto iter() const {
+        return Prop::StrIter{Io::SScan{_str}};
+    }
+};
+
+export template <typename S, typename T>
+struct Field {
+    Str name;
+    T S::* member;
+    u32 hash;
+};
+
+export template <typename S, typename T>
+constexpr Field<S, T> field(Str name, T S::* member) {
+    return {name, member, _hashStr(name)};
+}
+
+export template <typename... Fields>
+struct Schema {
+    static constexpr usize LEN = 0;
+
+    template <typename F>
+    constexpr void forEach(F&&, usize = 0) const {}
+};
+
+template <typename Head, typename... Tail>
+struct Schema<Head, Tail...> {
+    static constexpr usize LEN = 1 + sizeof...(Tail);
+
+    Head head;
+    Schema<Tail...> tail;
+
+    constexpr Schema(Head head, Tail... tail)
+        : head(head), tail(tail...) {}
+
+    template <typename F>
+    constexpr void forEach(F&& f, usize index = 0) const {
+        f(head, index);
+        tail.forEach(f, index + 1);
+    }
+};
+
+template <typename... Fields>
+Schema(Fields...) -> Schema<Fields...>;
+
+template <typename T>
+constexpr bool _optional = false;
+
+template <typename T>
+constexpr bool _optional<Opt<T>> = true;
+
+template <>
+constexpr bool _optional<bool> = true;
+
+bool _decodeValue(Prop const&, bool& out) {
+    out = true;
+    return true;
+}
+
+bool _decodeValue(Prop const& prop, u32& out) {
+    if (prop.raw().len() != sizeof(u32be))
+        return false;
+    out = prop.raw().cast<u32be>()[0];
+    return true;
+}
+
+bool _decodeValue(Prop const& prop, u64& out) {
+    if (prop.raw().len() == sizeof(u32be)) {
+        out = prop.raw().cast<u32be>()[0];
+        return true;
+    }
+    if (prop.raw().len() != sizeof(u64be))
+        return false;
+    out = prop.raw().cast<u64be>()[0];
+    return true;
+}
+
+bool _decodeValue(Prop const& prop, Phandle& out) {
+    return _decodeValue(prop, out.value);
+}
+
+bool _decodeValue(Prop const& prop, Slice<u32be>& out) {
+    if ((prop.raw().len() % sizeof(u32be)) != 0)
+        return false;
+    out = prop.cells();
+    return true;
+}
+
+bool _decodeValue(Prop const& prop, StrList& out) {
+    auto raw = prop.raw();
+    if (not raw.len() or last(raw) != 0)
+        return false;
+    out._str = sub(raw, 0, raw.len() - 1).cast<char>();
+    return true;
+}
+
+bool _decodeValue(Prop const& prop, Str& out) {
+    StrList list;
+    if (not _decodeValue(prop, list))
+        return false;
+    out = list._str;
+    return true;
+}
+
+template <Cell C>
+bool _decodeValue(Prop const& prop, C& out) {
+    auto cell = prop.cell<C>();
+    if (not cell)
+        return false;
+    out = cell.unwrap();
+    return true;
+}
+
+template <typename T>
+bool _decodeValue(Prop const& prop, Opt<T>& out) {
+    T value{};
+    if (not _decodeValue(prop, value))
+        return false;
+    out = value;
+    return true;
+}
+
+export template <typename S>
+Res<S> decode(Node const& node) {
+    static constexpr auto const& SCHEMA = S::SCHEMA;
+    static_assert(SCHEMA.LEN <= 64, "schema has too many fields");
+    static constexpr u64 ALL = SCHEMA.LEN == 64 ? ~u64(0) : (u64(1) << SCHEMA.LEN) - 1;
+
+    S out{};
+    u64 seen = 0;
+    bool invalid = false;
+
+    for (auto prop : node.iterProp()) {
+        auto name = prop._token.fullname;
+        u32 hash = _hashStr(name);
+        SCHEMA.forEach([&](auto const& field, usize index) {
+            u64 bit = u64(1) << index;
+            if (seen & bit or field.hash != hash or field.name != name)
+                return;
+            seen |= bit;
+            if (not _decodeValue(prop, out.*field.member))
+                invalid = true;
+        });
+        if (invalid)
+            return Error::invalidData("invalid property value");
+        if (seen == ALL)
+            break;
+    }
+
+    bool missing = false;
+    SCHEMA.forEach([&](auto const& field, usize index) {
+        using T = Meta::RemoveConstVolatileRef<decltype(out.*field.member)>;
+        if (not(seen & (u64(1) << index)) and not _optional<T>)
+            missing = true;
+    });
+    if (missing)
+        return Error::invalidData("missing required property");
+
+    return Ok(out);
+}
+
 } // namespace Vaerk::Dtb
@@ -0,0 +1,68 @@
+#pragma once
+
+import Karm.Core;
+import Vaerk.Dtb;
+
+namespace Vaerk::Dtb::Tests {
+
+using namespace Karm::Literals;
+
+// A small board covering every kind of value the writer knows about:
+// cells, 64-bit values, strings, string lists, empty properties and a
+// memory reservation.
+static Res<Bytes> _board(MutBytes buf) {
+    Writer w{buf};
+    try$(w.reserve(0x80000000, 0x200000));
+    try$(w.beginNode(""s));
+    try$(w.prop("#address-cells"s, 2u));
+    try$(w.prop("#size-cells"s, 2u));
+    try$(w.prop("model"s, "vaerk,test-board"s));
+    Array<Str, 2> compatible = {"vaerk,test-board"s, "vaerk,board"s};
+    try$(w.prop("compatible"s, compatible));
+
+    try$(w.beginNode("chosen"s));
+    try$(w.prop("bootargs"s, "console=ttyS0"s));
+    try$(w.prop("linux,initrd-start"s, u64(0x84000000)));
+    try$(w.prop("linux,initrd-end"s, u64(0x85000000)));
+    try$(w.endNode());
+
+    try$(w.beginNode("memory@80000000"s));
+    try$(w.prop("device_type"s, "memory"s));
+    Array<u64be, 2> reg = {u64(0x80000000), u64(0x40000000)};
+    try$(w.prop("reg"s, Bytes{reinterpret_cast<u8 const*>(reg.buf()), sizeof(reg)}));
+    try$(w.endNode());
+
+    try$(w.beginNode("cpus"s));
+    try$(w.prop("#address-cells"s, 1u));
+    try$(w.prop("#size-cells"s, 0u));
+    try$(w.beginNode("cpu@0"s));
+    try$(w.prop("device_type"s, "cpu"s));
+    try$(w.prop("reg"s, 0u));
+    try$(w.prop("dma-coherent"s));
+    try$(w.endNode());
+    try$(w.endNode());
+
+    try$(w.endNode());
+    return w.finish(1);
+}
+
+static bool _sameBytes(Bytes a, Bytes b) {
+    if (a.len() != b.len())
+        return false;
+    for (usize i = 0; i < a.len(); i++)
+        if (a[i] != b[i])
+            return false;
+    return true;
+}
+
+static Opt<u32> _u32(Node const& node, Str name) {
+    auto value = try$(node.getProperty<u32be>(name));
+    return Some<u32>(value);
+}
+
+static Opt<Str> _str(Node const& node, Str name) {
+    auto prop = try$(node.getProperty(name));
+    return prop.iterStr().next();
+}
+
+} // namespace Vaerk::Dtb::Tests
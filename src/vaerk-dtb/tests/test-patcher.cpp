@@ -0,0 +1,132 @@
+#include <karm/test>
+
+#include "fixtures.h"
+
+import Karm.Core;
+import Vaerk.Dtb;
+
+namespace Vaerk::Dtb::Tests {
+
+// A blob written at the start of a larger buffer, the rest is room for
+// the patcher to grow into.
+struct _Patched {
+    alignas(u64) Array<u8, 4096> buf = {};
+    usize len = 0;
+
+    Res<Patcher> open(usize room) {
+        len = try$(_board(MutBytes{buf.buf(), buf.len()})).len();
+        return Patcher::open(MutBytes{buf.buf(), len + room});
+    }
+};
+
+static Res<Blob> _reopen(Patcher& patcher) {
+    auto blob = patcher.blob();
+    try$(blob.validate());
+    return Ok(blob);
+}
+
+test$("dtb-patcher-in-place") {
+    _Patched p;
+    auto patcher = try$(p.open(0));
+
+    // Same size values fit where the old ones were.
+    try$(patcher.setProp("/cpus/cpu@0"s, "reg"s, 3u));
+    try$(patcher.setProp("/chosen"s, "bootargs"s, "console=ttyS1"s));
+    try$(patcher.removeProp("/cpus/cpu@0"s, "dma-coherent"s));
+    expectEq$(usize(patcher.header().totalSize), p.len);
+
+    auto blob = try$(_reopen(patcher));
+    auto chosen = try$(blob.root().findChildren("chosen"s));
+    expectEq$(_str(chosen, "bootargs"s), Some("console=ttyS1"s));
+    expect$(try$(blob.initrd()).start == 0x84000000u);
+
+    auto cpu = try$(try$(blob.root().findChildren("cpus"s)).findChildren("cpu"s));
+    expectEq$(_u32(cpu, "reg"s), Some(3u));
+    expect$(not cpu.getProperty("dma-coherent"s));
+    expectEq$(_str(cpu, "device_type"s), Some("cpu"s));
+    return Ok();
+}
+
+test$("dtb-patcher-grows") {
+    _Patched p;
+    auto patcher = try$(p.open(1024));
+
+    try$(patcher.setProp("/chosen"s, "bootargs"s, "console=ttyS0,115200 earlycon root=/dev/vda"s));
+    try$(patcher.setProp("/chosen"s, "linux,initrd-end"s, u64(0x86000000)));
+    try$(patcher.setProp("/chosen"s, "vaerk,handover"s, u64(0x87000000)));
+    try$(patcher.setProp("/memory@80000000"s, "numa-node-id"s, 0u));
+    try$(patcher.reserve(0x90000000, 0x1000));
+
+    auto blob = try$(_reopen(patcher));
+    expectEq$(blob.memoryReservations().len(), 2uz);
+    expectEq$(u64(blob.memoryReservations()[1].address), 0x90000000u);
+
+    auto chosen = try$(blob.root().findChildren("chosen"s));
+    expectEq$(_str(chosen, "bootargs"s), Some("console=ttyS0,115200 earlycon root=/dev/vda"s));
+    expectEq$(u64(try$(chosen.getProperty<u64be>("vaerk,handover"s))), 0x87000000u);
+    expectEq$(try$(blob.initrd()).end(), 0x86000000u);
+
+    // Nodes past the patched one moved, but are left untouched.
+    auto memory = try$(blob.root().findChildren("memory"s));
+    expectEq$(_u32(memory, "numa-node-id"s), Some(0u));
+    expectEq$(_str(memory, "device_type"s), Some("memory"s));
+    auto cpu = try$(try$(blob.root().findChildren("cpus"s)).findChildren("cpu"s));
+    expectEq$(_u32(cpu, "reg"s), Some(0u));
+    expect$(cpu.getProperty("dma-coherent"s));
+    return Ok();
+}
+
+test$("dtb-patcher-reuses-slack") {
+    _Patched p;
+    auto patcher = try$(p.open(1024));
+
+    // The first growth leaves NOPs behind, the next ones fill them in
+    // without moving the rest of the blob again.
+    try$(patcher.setProp("/chosen"s, "a"s, 1u));
+    usize total = patcher.header().totalSize;
+    try$(patcher.setProp("/chosen"s, "a"s, u64(2)));
+    expectEq$(usize(patcher.header().totalSize), total);
+
+    auto blob = try$(_reopen(patcher));
+    auto chosen = try$(blob.root().findChildren("chosen"s));
+    expectEq$(u64(try$(chosen.getProperty<u64be>("a"s))), 2u);
+    expectEq$(_str(chosen, "bootargs"s), Some("console=ttyS0"s));
+    return Ok();
+}
+
+test$("dtb-patcher-out-of-room") {
+    _Patched p;
+    auto patcher = try$(p.open(0));
+
+    expect$(not patcher.setProp("/chosen"s, "bootargs"s, "console=ttyS0,115200"s));
+    expect$(not patcher.reserve(0x90000000, 0x1000));
+    expect$(not patcher.setProp("/missing"s, "reg"s, 0u));
+    expect$(not patcher.removeProp("/chosen"s, "missing"s));
+
+    // A failed patch leaves a valid blob behind.
+    try$(_reopen(patcher));
+    return Ok();
+}
+
+test$("dtb-patcher-missing-node") {
+    _Patched p;
+    auto patcher = try$(p.open(1024));
+
+    // The new property name isn't interned for a node that doesn't exist.
+    usize total = patcher.header().totalSize;
+    expect$(not patcher.setProp("/missing"s, "vaerk,new"s, 0u));
+    expectEq$(usize(patcher.header().totalSize), total);
+    return Ok();
+}
+
+test$("dtb-patcher-rejects-malformed") {
+    _Patched p;
+    auto patcher = try$(p.open(1024));
+
+    // The root node's BEGIN_NODE token becomes garbage.
+    patcher._at<u32be>(patcher.header().structureBlockOffset) = 0x42u;
+    expect$(not Patcher::open(MutBytes{p.buf.buf(), p.len + 1024}));
+    return Ok();
+}
+
+} // namespace Vaerk::Dtb::Tests
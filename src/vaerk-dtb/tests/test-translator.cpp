@@ -0,0 +1,164 @@
+#include <karm/test>
+
+#include "fixtures.h"
+
+import Karm.Core;
+import Vaerk.Dtb;
+
+namespace Vaerk::Dtb::Tests {
+
+template <usize N>
+static Res<> _cells(Writer& w, Str name, Array<u32be, N> cells) {
+    return w.prop(name, Bytes{reinterpret_cast<u8 const*>(cells.buf()), sizeof(cells)});
+}
+
+static Res<Bytes> _buses(MutBytes buf) {
+    Writer w{buf};
+    try$(w.beginNode(""s));
+    try$(w.prop("#address-cells"s, 2u));
+    try$(w.prop("#size-cells"s, 2u));
+
+    try$(w.beginNode("soc"s));
+    try$(w.prop("#address-cells"s, 1u));
+    try$(w.prop("#size-cells"s, 1u));
+    try$(_cells<4>(w, "ranges"s, {0x0u, 0x0u, 0x10000000u, 0x1000000u}));
+
+    try$(w.beginNode("uart@1000"s));
+    try$(_cells<2>(w, "reg"s, {0x1000u, 0x100u}));
+    try$(w.endNode());
+
+    try$(w.beginNode("bridge@2000"s));
+    try$(w.prop("#address-cells"s, 1u));
+    try$(w.prop("#size-cells"s, 1u));
+    try$(_cells<3>(w, "ranges"s, {0x0u, 0x2000u, 0x100u}));
+    try$(w.beginNode("dev@10"s));
+    try$(w.endNode());
+    try$(w.endNode());
+
+    try$(w.beginNode("transparent"s));
+    try$(w.prop("#address-cells"s, 1u));
+    try$(w.prop("#size-cells"s, 1u));
+    try$(w.prop("ranges"s));
+    try$(w.beginNode("dev@4000"s));
+    try$(w.endNode());
+    try$(w.endNode());
+    try$(w.endNode());
+
+    try$(w.beginNode("opaque"s));
+    try$(w.beginNode("dev@0"s));
+    try$(w.endNode());
+    try$(w.endNode());
+
+    try$(w.endNode());
+    return w.finish();
+}
+
+test$("dtb-translator") {
+    alignas(u64) Array<u8, 4096> buf = {};
+    auto blob = try$(Blob::open(try$(_buses(MutBytes{buf.buf(), buf.len()}))));
+    try$(blob.validate());
+
+    Array<IndexNode, 16> nodes;
+    Array<IndexProp, 32> props;
+    Array<IndexKey, 4> phandles;
+    Array<IndexKey, 16> names;
+    auto index = try$(Index::build(blob, {
+        {nodes.buf(), nodes.len()},
+        {props.buf(), props.len()},
+        {phandles.buf(), phandles.len()},
+        {names.buf(), names.len()},
+    }));
+
+    Array<Translator::Bus, 16> buses;
+    Array<Window, 8> windows;
+    Translator translator{
+        index,
+        {buses.buf(), buses.len()},
+        {windows.buf(), windows.len()},
+    };
+
+    auto uart = try$(index.byPath("/soc/uart@1000"s));
+    expectEq$(translator.translate(uart, 0x1000), Some<u64>(0x10001000));
+    expectEq$(translator.translate(try$(blob.find("/soc/uart@1000"s)), 0x1000), Some<u64>(0x10001000));
+
+    // Windows are intersected with the ones of the parent bus.
+    auto dev = try$(index.byPath("/soc/bridge@2000/dev@10"s));
+    expectEq$(translator.translate(dev, 0x10), Some<u64>(0x10002010));
+    expect$(not translator.translate(dev, 0x100));
+    expectEq$(try$(translator.windows(dev)).len(), 1uz);
+
+    // An empty `ranges` is an identity mapping, a missing one isn't
+    // translatable.
+    auto identity = try$(index.byPath("/soc/transparent/dev@4000"s));
+    expectEq$(translator.translate(identity, 0x4000), Some<u64>(0x10004000));
+    expect$(not translator.translate(try$(index.byPath("/opaque/dev@0"s)), 0x0));
+
+    // Top level nodes sit on the CPU address space.
+    expectEq$(translator.translate(try$(index.byPath("/soc"s)), 0x1234), Some<u64>(0x1234));
+    return Ok();
+}
+
+static Res<Bytes> _wideAndNarrow(MutBytes buf) {
+    Writer w{buf};
+    try$(w.beginNode(""s));
+    try$(w.prop("#address-cells"s, 1u));
+    try$(w.prop("#size-cells"s, 1u));
+
+    try$(w.beginNode("wide"s));
+    try$(w.prop("#address-cells"s, 1u));
+    try$(w.prop("#size-cells"s, 1u));
+    try$(_cells<6>(w, "ranges"s, {0x0u, 0x1000u, 0x100u, 0x100u, 0x2000u, 0x100u}));
+    try$(w.beginNode("dev@0"s));
+    try$(w.endNode());
+    try$(w.endNode());
+
+    try$(w.beginNode("narrow"s));
+    try$(w.prop("#address-cells"s, 1u));
+    try$(w.prop("#size-cells"s, 1u));
+    try$(_cells<3>(w, "ranges"s, {0x0u, 0x4000u, 0x100u}));
+    try$(w.beginNode("dev@10"s));
+    try$(w.endNode());
+    try$(w.endNode());
+
+    try$(w.endNode());
+    return w.finish();
+}
+
+test$("dtb-translator-out-of-windows") {
+    alignas(u64) Array<u8, 4096> buf = {};
+    auto blob = try$(Blob::open(try$(_wideAndNarrow(MutBytes{buf.buf(), buf.len()}))));
+    try$(blob.validate());
+
+    Array<IndexNode, 8> nodes;
+    Array<IndexProp, 16> props;
+    Array<IndexKey, 4> phandles;
+    Array<IndexKey, 8> names;
+    auto index = try$(Index::build(blob, {
+        {nodes.buf(), nodes.len()},
+        {props.buf(), props.len()},
+        {phandles.buf(), phandles.len()},
+        {names.buf(), names.len()},
+    }));
+
+    // Room for a single window, the wide bus fails on its second one.
+    Array<Translator::Bus, 8> buses;
+    Array<Window, 1> windows;
+    Translator translator{
+        index,
+        {buses.buf(), buses.len()},
+        {windows.buf(), windows.len()},
+    };
+
+    auto wide = try$(index.byPath("/wide/dev@0"s));
+    expect$(not translator.translate(wide, 0x0));
+    expect$(buses[try$(index.byPath("/wide"s))].failed);
+    expect$(not translator.translate(wide, 0x0));
+
+    // The window pushed before the failure was given back.
+    auto narrow = try$(index.byPath("/narrow/dev@10"s));
+    expectEq$(translator.translate(narrow, 0x10), Some<u64>(0x4010));
+    expectEq$(try$(translator.windows(narrow)).len(), 1uz);
+    return Ok();
+}
+
+} // namespace Vaerk::Dtb::Tests
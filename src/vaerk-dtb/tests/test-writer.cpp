@@ -0,0 +1,96 @@
+#include <karm/test>
+
+#include "fixtures.h"
+
+import Karm.Core;
+import Vaerk.Dtb;
+
+namespace Vaerk::Dtb::Tests {
+
+// Write a parsed node back out, property by property.
+static Res<> _copy(Writer& w, Node const& node) {
+    try$(w.beginNode(node.fullname()));
+    for (auto prop : node.iterProp())
+        try$(w.prop(prop.name(), prop.raw()));
+    for (auto child : node.iterChildren())
+        try$(_copy(w, child));
+    return w.endNode();
+}
+
+test$("dtb-writer-parses-back") {
+    alignas(u64) Array<u8, 4096> buf = {};
+    auto blob = try$(Blob::open(try$(_board(MutBytes{buf.buf(), buf.len()}))));
+    try$(blob.validate());
+
+    expectEq$(u32(blob.header().bootCpuidPhys), 1u);
+    expectEq$(blob.memoryReservations().len(), 1uz);
+    expectEq$(u64(blob.memoryReservations()[0].address), 0x80000000u);
+    expectEq$(u64(blob.memoryReservations()[0].size), 0x200000u);
+
+    auto root = blob.root();
+    expectEq$(root.name(), "/"s);
+    expectEq$(_u32(root, "#address-cells"s), Some(2u));
+    expectEq$(_str(root, "model"s), Some("vaerk,test-board"s));
+
+    auto compatible = try$(root.getProperty("compatible"s)).iterStr();
+    expectEq$(compatible.next(), Some("vaerk,test-board"s));
+    expectEq$(compatible.next(), Some("vaerk,board"s));
+    expect$(not compatible.next());
+
+    auto initrd = try$(blob.initrd());
+    expectEq$(initrd.start, 0x84000000u);
+    expectEq$(initrd.end(), 0x85000000u);
+
+    auto memory = try$(root.findChildren("memory"s));
+    expectEq$(memory.address(), Some(0x80000000uz));
+    auto reg = try$(memory.getProperty("reg"s)).cells();
+    expectEq$(reg.len(), 4uz);
+    expectEq$(u32(reg[1]), 0x80000000u);
+    expectEq$(u32(reg[3]), 0x40000000u);
+
+    auto cpu = try$(try$(root.findChildren("cpus"s)).findChildren("cpu"s));
+    expectEq$(_str(cpu, "device_type"s), Some("cpu"s));
+    expectEq$(try$(cpu.getProperty("dma-coherent"s)).sniff(), Prop::NIL);
+    return Ok();
+}
+
+test$("dtb-writer-round-trip") {
+    // Parsing a blob and writing it back must give the exact same bytes,
+    // down to the order of the strings block.
+    alignas(u64) Array<u8, 4096> first = {};
+    auto original = try$(_board(MutBytes{first.buf(), first.len()}));
+    auto blob = try$(Blob::open(original));
+    try$(blob.validate());
+
+    alignas(u64) Array<u8, 4096> second = {};
+    Writer w{MutBytes{second.buf(), second.len()}};
+    for (auto const& r : blob.memoryReservations())
+        try$(w.reserve(r.address, r.size));
+    try$(_copy(w, blob.root()));
+    auto copy = try$(w.finish(blob.header().bootCpuidPhys));
+
+    expect$(_sameBytes(original, copy));
+    return Ok();
+}
+
+test$("dtb-writer-rejects-misuse") {
+    alignas(u64) Array<u8, 4096> buf = {};
+    Writer w{MutBytes{buf.buf(), buf.len()}};
+    expect$(not w.endNode());
+    expect$(not w.prop("orphan"s, 1u));
+
+    try$(w.beginNode(""s));
+    expect$(not w.reserve(0, 0x1000));
+    expect$(not w.finish());
+    try$(w.endNode());
+    expect$(not w.beginNode("second-root"s));
+    return Ok();
+}
+
+test$("dtb-writer-out-of-room") {
+    alignas(u64) Array<u8, 96> buf = {};
+    expect$(not _board(MutBytes{buf.buf(), buf.len()}));
+    return Ok();
+}
+
+} // namespace Vaerk::Dtb::Tests
@@ -143,6 +143,7 @@ struct BootService;
 struct ConfigurationTable {
     static constexpr Ref::Guid ACPI_TABLE_GUID = {0xeb9d2d30, 0x2d88, 0x11d3, 0x9a16, {0x00, 0x90, 0x27, 0x3f, 0xc1, 0x4d}};
     static constexpr Ref::Guid ACPI2_TABLE_GUID = {0x8868e871, 0xe4f1, 0x11d3, 0xbc22, {0x00, 0x80, 0xc7, 0x3c, 0x88, 0x81}};
+    static constexpr Ref::Guid DEVICE_TREE_GUID = {0xb1b621d5, 0xf19c, 0x41a5, 0x830b, {0xd9, 0x15, 0x2c, 0x69, 0xaa, 0xe0}};
 
     Ref::Guid vendorGuid;
     void* table;
@@ -38,6 +38,13 @@ struct Builder {
     usize _size{};
     char* _string{};
     _Vec<ViewBuf<Record>> _records;
+    bool _batched = false;
+
+    // Records and strings that couldn't be added. Once the firmware console
+    // is gone, `quiet` stops them from being logged and the caller reports
+    // the count instead.
+    usize dropped = 0;
+    bool quiet = false;
 
     Builder(MutSlice<u8> slice)
         : _buf(slice.buf()),
@@ -56,72 +63,318 @@ struct Builder {
         return *static_cast<Payload*>(_buf);
     }
 
+    // Record slots that fit between the records and the strings, which
+    // grow down from the end of the buffer.
+    usize _capacity() {
+        return (_string - reinterpret_cast<char*>(payload().records)) / sizeof(Record);
+    }
+
+    bool _hasRoom(usize more) {
+        return _records.len() + more <= _capacity();
+    }
+
+    // Index of the first record that ends after `addr`.
+    usize _firstEndingAfter(u64 addr) {
+        usize lo = 0, hi = _records.len();
+        while (lo < hi) {
+            usize mid = lo + (hi - lo) / 2;
+            if (_records[mid].end() <= addr)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // Index of the first record that starts at or after `addr`.
+    usize _firstStartingFrom(u64 addr) {
+        usize lo = 0, hi = _records.len();
+        while (lo < hi) {
+            usize mid = lo + (hi - lo) / 2;
+            if (_records[mid].start < addr)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // Free records only coalesce when their flags match, so that tags
+    // like the NUMA node survive.
+    static bool _mergeable(Record lower, Record upper) {
+        return isFree(lower.tag) and
+               isFree(upper.tag) and
+               lower.flags == upper.flags and
+               lower.end() == upper.start;
+    }
+
+    // Insert a free record at `i`, coalescing it with its free neighbours.
+    void _insertFree(usize i, Record record) {
+        bool mergePrev = i > 0 and _mergeable(_records[i - 1], record);
+        bool mergeNext = i < _records.len() and _mergeable(record, _records[i]);
+
+        if (mergePrev and mergeNext) {
+            _records[i - 1].size += record.size + _records[i].size;
+            _records.removeAt(i);
+        } else if (mergePrev) {
+            _records[i - 1].size += record.size;
+        } else if (mergeNext) {
+            _records[i].start = record.start;
+            _records[i].size += record.size;
+        } else {
+            _records.insert(i, record);
+        }
+    }
+
+    // Records are kept sorted and never overlap, free records are carved
+    // around reserved ones and adjacent free records are coalesced.
     void add(Record record) {
+        _resolveBatch();
+
         if (record.size == 0)
             return;
 
-        for (usize i = 0; i < _records.len(); i++) {
-            auto other = _records[i];
+        // A record can split a free one in two, taking up to two more slots.
+        if (not _hasRoom(2)) {
+            dropped++;
+            if (not quiet)
+                logWarn("handover: no room left for record {}", record);
+            return;
+        }
 
-            // Merge with previous
-            if (other.tag == record.tag and
-                other.end() == record.start and
-                isFree(record.tag)) {
-                // logDebug("handover: merge {} with {}", record, other);
-                _records.removeAt(i);
-                other.size += record.size;
-                add(other);
+        // Records overlapping the new one are in [lo, hi)
+        usize lo = _firstEndingAfter(record.start);
+        usize hi = _firstStartingFrom(record.end());
+
+        for (usize i = lo; i < hi; i++) {
+            auto other = _records[i];
+            if (isFree(record.tag) == isFree(other.tag)) {
+                dropped++;
+                if (not quiet)
+                    logWarn("handover: record {} colides with {}", record, other);
                 return;
             }
+        }
 
-            // Merge with next
-            if (other.tag == record.tag and
-                other.start == record.end() and
-                isFree(record.tag)) {
-                // logDebug("handover: merge {} with {}", record, other);
+        if (isFree(record.tag)) {
+            // Fill the gaps left between the reserved records, from the
+            // top down so that lower indices stay valid.
+            u64 end = record.end();
+            for (usize i = hi; i-- > lo;) {
+                auto other = _records[i];
+                if (other.end() < end) {
+                    Record piece = record;
+                    piece.start = other.end();
+                    piece.size = end - other.end();
+                    _insertFree(i + 1, piece);
+                }
+                end = other.start;
+            }
 
-                _records.removeAt(i);
-                record.size += other.size;
+            if (end > record.start) {
+                Record piece = record;
+                piece.size = end - record.start;
+                _insertFree(lo, piece);
+            }
+            return;
+        }
+
+        // Only free records overlap, trim the first and last ones and drop
+        // the ones fully covered.
+        Array<Record, 3> replacement;
+        usize len = 0;
+
+        if (lo < hi and _records[lo].start < record.start) {
+            Record lower = _records[lo];
+            lower.size = record.start - lower.start;
+            replacement[len++] = lower;
+        }
+
+        replacement[len++] = record;
+
+        if (lo < hi and _records[hi - 1].end() > record.end()) {
+            Record upper = _records[hi - 1];
+            upper.size = upper.end() - record.end();
+            upper.start = record.end();
+            replacement[len++] = upper;
+        }
+
+        while (hi - lo > len)
+            _records.removeAt(--hi);
+        while (hi - lo < len)
+            _records.insert(hi++, record);
+        for (usize i = 0; i < len; i++)
+            _records[lo + i] = replacement[i];
+    }
+
+    // Queue records without keeping them sorted, they are resolved all at
+    // once, with the same semantics as add(), by the next add() or finalize().
+    //
+    // Resolving stages up to one copy of every record past the end of the
+    // list, if that doesn't fit the records are added one by one instead.
+    void addBatch(Slice<Record> records) {
+        if (2 * (_records.len() + records.len()) > _capacity()) {
+            for (auto const& record : records)
                 add(record);
+            return;
+        }
+
+        for (auto const& record : records) {
+            if (record.size == 0)
+                continue;
+            _records.pushBack(record);
+            _batched = true;
+        }
+    }
+
+    void _emit(usize& len, Record record) {
+        if (len > 0) {
+            auto& last = _records[len - 1];
+            if (_mergeable(last, record)) {
+                last.size += record.size;
                 return;
             }
+        }
+        _records[len++] = record;
+    }
 
-            if (colidesWith(record, other)) {
-                if (isFree(record.tag) and not isFree(other.tag)) {
-                    // logDebug("handover: splitting record {} with {}", record, other);
+    // Sort the batch once, then carve free records around reserved ones in
+    // a single sweep. The cleaned reserved and free records are staged past
+    // the end of the batch, and the result is written back from the start.
+    void _resolveBatch() {
+        if (not _batched)
+            return;
+        _batched = false;
 
-                    _records.removeAt(i);
-                    auto [lower, upper] = split(record, other);
+        usize n = _records.len();
+        sort(MutSlice<Record>{payload().records, n}, [](Record const& a, Record const& b) {
+            return a.start <=> b.start;
+        });
 
-                    add(other);
-                    add(lower);
-                    add(upper);
-                    return;
-                } else if (not isFree(record.tag) and isFree(other.tag)) {
-                    // logDebug("handover: splitting record {} with {}", other, record);
+        usize reservedStart = _records.len();
+        for (usize i = 0; i < n; i++) {
+            auto record = _records[i];
+            if (isFree(record.tag))
+                continue;
+            if (_records.len() > reservedStart and last(_records).end() > record.start) {
+                dropped++;
+                if (not quiet)
+                    logWarn("handover: record {} colides with {}", record, last(_records));
+                continue;
+            }
+            _records.pushBack(record);
+        }
 
-                    _records.removeAt(i);
+        usize freeStart = _records.len();
+        for (usize i = 0; i < n; i++) {
+            auto record = _records[i];
+            if (not isFree(record.tag))
+                continue;
+            if (_records.len() > freeStart) {
+                auto& prev = last(_records);
+                if (prev.end() > record.start) {
+                    dropped++;
+                    if (not quiet)
+                        logWarn("handover: record {} colides with {}", record, prev);
+                    continue;
+                }
+                if (_mergeable(prev, record)) {
+                    prev.size += record.size;
+                    continue;
+                }
+            }
+            _records.pushBack(record);
+        }
+        usize end = _records.len();
 
-                    auto [lower, upper] = split(other, record);
-                    add(record);
-                    add(lower);
-                    add(upper);
-                    return;
-                } else {
-                    logWarn("handover: record {} colides with {}", record, other);
-                    return;
+        usize len = 0;
+        usize r = reservedStart;
+        usize f = freeStart;
+        u64 reservedEnd = 0;
+        Opt<Record> curr = NONE;
+
+        while (true) {
+            if (not curr and f < end)
+                curr = _records[f++];
+
+            // Drop whatever the last reserved record covers.
+            if (curr and curr->start < reservedEnd) {
+                if (curr->end() <= reservedEnd) {
+                    curr = NONE;
+                    continue;
                 }
+                curr->size = curr->end() - reservedEnd;
+                curr->start = reservedEnd;
             }
 
-            if (other.start > record.start) {
-                // logDebug("handover: insert {} at {}", record, i);
-                _records.insert(i, record);
-                return;
+            if (not curr and r == freeStart)
+                break;
+
+            if (curr and (r == freeStart or curr->start < _records[r].start)) {
+                if (r < freeStart and curr->end() > _records[r].start) {
+                    Record lower = *curr;
+                    lower.size = _records[r].start - curr->start;
+                    _emit(len, lower);
+                    curr->size = curr->end() - _records[r].start;
+                    curr->start = _records[r].start;
+                } else {
+                    _emit(len, *curr);
+                    curr = NONE;
+                }
+            } else {
+                auto record = _records[r++];
+                reservedEnd = record.end();
+                _emit(len, record);
             }
         }
 
-        // logDebug("handover: append {}", record);
-        _records.pushBack(record);
+        while (_records.len() > len)
+            _records.popBack();
+    }
+
+    // Split the free record containing `addr` in two at `addr`.
+    void _splitFreeAt(u64 addr) {
+        usize i = _firstEndingAfter(addr);
+        if (i == _records.len() or _records[i].start >= addr or not isFree(_records[i].tag))
+            return;
+        Record upper = _records[i];
+        upper.start = addr;
+        upper.size = _records[i].end() - addr;
+        _records[i].size = addr - _records[i].start;
+        _records.insert(i + 1, upper);
+    }
+
+    // Set the flags of the free memory inside `range`, free records crossing
+    // its bounds are split, reserved records are left alone.
+    void flagFree(urange range, u32 flags) {
+        _resolveBatch();
+
+        if (range.size == 0)
+            return;
+
+        if (not _hasRoom(2)) {
+            dropped++;
+            if (not quiet)
+                logWarn("handover: no room left to flag {:x}-{:x}", range.start, range.end());
+            return;
+        }
+
+        _splitFreeAt(range.start);
+        _splitFreeAt(range.end());
+
+        usize lo = _firstEndingAfter(range.start);
+        usize hi = _firstStartingFrom(range.end());
+        for (usize i = lo; i < hi; i++)
+            if (isFree(_records[i].tag))
+                _records[i].flags = flags;
+
+        // Coalesce with the neighbours that now share the same flags.
+        for (usize i = min(hi + 1, _records.len()); i-- > max(lo, 1uz);) {
+            if (_mergeable(_records[i - 1], _records[i])) {
+                _records[i - 1].size += _records[i].size;
+                _records.removeAt(i);
+            }
+        }
     }
 
     void add(Tag tag, u32 flags = 0, urange range = {}, u64 more = 0) {
@@ -135,6 +388,18 @@ struct Builder {
     }
 
     usize add(Str str) {
+        // Strings shrink the room left for records, which a pending batch
+        // was promised in addBatch().
+        _resolveBatch();
+
+        auto* recordsEnd = reinterpret_cast<char*>(payload().records + _records.len());
+        if (usize(_string - recordsEnd) < str.len() + 1) {
+            dropped++;
+            if (not quiet)
+                logWarn("handover: no room left for string {}", str);
+            return 0;
+        }
+
         _string -= str.len() + 1;
         std::memcpy(_string, str.buf(), str.len());
         _string[str.len()] = '\0';
@@ -146,6 +411,7 @@ struct Builder {
     }
 
     Payload& finalize() {
+        _resolveBatch();
         payload().len = _records.len();
         return payload();
     }
@@ -0,0 +1,87 @@
+#pragma once
+
+import Karm.Core;
+
+#include "spec.h"
+
+namespace Handover {
+
+// A precomputed load layout of a kernel ELF image, produced at build time
+// by handover-dump so that loaders don't have to parse the ELF at boot.
+// The segments are followed by a copy of the kernel's request section.
+
+static constexpr u32 IMAGE_MAGIC = 0x4d494448; // "HDIM"
+static constexpr u64 IMAGE_PAGE_SIZE = 4096;
+
+struct Segment {
+    u64 vaddr;
+    u64 offset;
+    u64 filesz;
+    u64 memsz;
+    u64 align;
+    u32 flags;
+    u32 _pad = 0;
+
+    u64 end() const {
+        return vaddr + memsz;
+    }
+
+    u64 bss() const {
+        return memsz - filesz;
+    }
+};
+
+struct Image {
+    u32 magic;
+    u32 len;
+    u64 entry;
+    u64 start; // Lowest page of the loaded image
+    u64 size;  // Page aligned size of the loaded image
+    Segment segments[];
+
+    static usize sizeFor(usize len) {
+        return sizeof(Image) + len * sizeof(Segment);
+    }
+
+    // `fileSize` is the size of the ELF file the segments are loaded from.
+    Res<> validate(usize bufSize, usize fileSize) const {
+        if (bufSize < sizeof(Image) or magic != IMAGE_MAGIC)
+            return Error::invalidData("invalid image manifest");
+
+        if (len > (bufSize - sizeof(Image)) / sizeof(Segment))
+            return Error::invalidData("segment count out of bounds");
+
+        for (auto const& s : *this) {
+            if (s.filesz > s.memsz)
+                return Error::invalidData("segment file size exceeds memory size");
+
+            if (s.offset > fileSize or s.filesz > fileSize - s.offset)
+                return Error::invalidData("segment out of file bounds");
+
+            if (s.vaddr < start or s.end() < s.vaddr or s.end() > start + size)
+                return Error::invalidData("segment out of image bounds");
+        }
+
+        return Ok();
+    }
+
+    // The request section stored after the segments, checked like
+    // parseRequests() does for the ELF section.
+    Res<Slice<Request>> requests(usize bufSize) const {
+        usize offset = sizeFor(len);
+        if (bufSize < offset)
+            return Error::invalidData("image manifest too small");
+        auto const* buf = reinterpret_cast<Request const*>(reinterpret_cast<u8 const*>(this) + offset);
+        return parseRequests({buf, (bufSize - offset) / sizeof(Request)});
+    }
+
+    Segment const* begin() const {
+        return segments;
+    }
+
+    Segment const* end() const {
+        return segments + len;
+    }
+};
+
+} // namespace Handover
@@ -0,0 +1,118 @@
+#pragma once
+
+import Karm.Core;
+
+#include "spec.h"
+
+namespace Handover {
+
+// Constant time lookups into a validated payload, for init code that
+// queries it many times.
+//
+// The blob table lives in caller supplied storage, sized with blobSlots(),
+// so that it can be built before any allocator exists.
+struct Index {
+    enum _TagSlot : usize {
+#define ITER(NAME, VALUE) _SLOT_##NAME,
+        FOREACH_TAG(ITER)
+#undef ITER
+        _SLOT_COUNT,
+    };
+
+    struct BlobSlot {
+        u32 hash = 0;
+        Record const* record = nullptr;
+    };
+
+    Payload const* _payload = nullptr;
+    Array<Record const*, _SLOT_COUNT> _tags{};
+    MutSlice<BlobSlot> _blobs{};
+
+    static Opt<usize> _tagSlot(Tag tag) {
+        switch (tag) {
+#define ITER(NAME, VALUE) \
+    case Tag::NAME:       \
+        return _SLOT_##NAME;
+            FOREACH_TAG(ITER)
+#undef ITER
+        }
+        return NONE;
+    }
+
+    static u32 _hash(char const* str) {
+        u32 hash = 0x811c9dc5;
+        for (; *str; str++)
+            hash = (hash ^ u8(*str)) * 0x01000193;
+        return hash;
+    }
+
+    void _insertBlob(Record const& record) {
+        u32 hash = _hash(_payload->stringAt(record.blob.name));
+        for (usize i = 0; i < _blobs.len(); i++) {
+            auto& slot = _blobs[(hash + i) % _blobs.len()];
+            if (slot.record) {
+                // Keep the first blob with a given name, like blobByName().
+                if (slot.hash == hash and
+                    cstrEq(_payload->stringAt(slot.record->blob.name), _payload->stringAt(record.blob.name)))
+                    return;
+                continue;
+            }
+            slot = {hash, &record};
+            return;
+        }
+    }
+
+    // Slots needed to index the blobs of `payload`, past 3/4 load probing
+    // degrades so the table is kept below that.
+    static usize blobSlots(Payload const& payload) {
+        usize blobs = 0;
+        for (auto const& r : payload)
+            if (r.tag == Tag::BLOB)
+                blobs++;
+        return blobs + (blobs + 2) / 3;
+    }
+
+    static Res<Index> build(Payload const& payload, usize bufSize, MutSlice<BlobSlot> blobs) {
+        try$(payload.validate(bufSize));
+
+        if (blobs.len() < blobSlots(payload))
+            return Error::outOfMemory("blob table too small");
+
+        Index index;
+        index._payload = &payload;
+        index._blobs = blobs;
+        for (auto& slot : index._blobs)
+            slot = {};
+
+        for (auto const& r : payload) {
+            auto slot = _tagSlot(r.tag);
+            if (slot and not index._tags[*slot])
+                index._tags[*slot] = &r;
+
+            if (r.tag == Tag::BLOB)
+                index._insertBlob(r);
+        }
+        return Ok(index);
+    }
+
+    Record const* findTag(Tag tag) const {
+        auto slot = _tagSlot(tag);
+        if (not slot)
+            return _payload->findTag(tag);
+        return _tags[*slot];
+    }
+
+    Record const* blobByName(char const* name) const {
+        u32 hash = _hash(name);
+        for (usize i = 0; i < _blobs.len(); i++) {
+            auto const& slot = _blobs[(hash + i) % _blobs.len()];
+            if (not slot.record)
+                return nullptr;
+            if (slot.hash == hash and cstrEq(_payload->stringAt(slot.record->blob.name), name))
+                return slot.record;
+        }
+        return nullptr;
+    }
+};
+
+} // namespace Handover
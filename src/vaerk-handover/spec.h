@@ -9,6 +9,8 @@ using namespace Karm;
 namespace Handover {
 
 #ifdef __ck_paging_sv39__
+// The top 2GiB, like on other 64-bit targets, still fit in Sv39's upper half.
+inline usize KERNEL_BASE = 0xffffffff80000000;
 inline usize UPPER_HALF = 0xffffffff00000000;
 #elifdef __ck_bits_64__
 inline usize KERNEL_BASE = 0xffffffff80000000;
@@ -32,6 +34,7 @@ static constexpr u32 COOLBOOT = 0xc001b001;
     TAG(FDT, 0xb628bbc1)      \
     TAG(FB, 0xe2d55685)       \
     TAG(RESERVED, 0xb8841d2d) \
+    TAG(REUSABLE, 0x6c1e4fa7) \
     TAG(END, 0xffffffff)
 
 enum struct Tag : u32 {
@@ -57,6 +60,15 @@ inline bool isFree(Tag tag) {
     return tag == FREE;
 }
 
+// Flags of BLOB records
+static constexpr u32 BLOB_LZ4 = 1 << 0; // An LZ4 frame carrying its content size
+
+// Flags of RESERVED and REUSABLE records
+static constexpr u32 RESERVED_NO_MAP = 1 << 0; // Must not be mapped at all, not even speculatively
+
+// Flags of FREE records
+static constexpr u32 FREE_NUMA = 1u << 31; // The low 16 bits hold the NUMA node
+
 enum struct PixelFormat : u16 {
     RGBX8888 = 0x7451,
     BGRX8888 = 0xd040,
@@ -98,6 +110,16 @@ struct Record {
         return size == 0;
     }
 
+    bool compressed() const {
+        return tag == Tag::BLOB and (flags & BLOB_LZ4);
+    }
+
+    Opt<u32> numaNode() const {
+        if (tag != Tag::FREE or not(flags & FREE_NUMA))
+            return NONE;
+        return flags & 0xffff;
+    }
+
     template <typename R>
     R range() const {
         return R{
@@ -143,6 +165,53 @@ struct Payload {
         return nullptr;
     }
 
+    bool _validString(u64 offset) const {
+        if (offset == 0)
+            return true;
+        if (offset < sizeof(Payload) + len * sizeof(Record) or offset >= size)
+            return false;
+        char const* data = reinterpret_cast<char const*>(this);
+        for (usize i = offset; i < size; i++)
+            if (data[i] == '\0')
+                return true;
+        return false;
+    }
+
+    // Check that the payload is self-consistent before trusting any of its
+    // offsets. `bufSize` is the size of the memory the payload lives in.
+    Res<> validate(usize bufSize) const {
+        if (bufSize < sizeof(Payload))
+            return Error::invalidData("payload too small");
+
+        if (magic != COOLBOOT)
+            return Error::invalidData("invalid payload magic");
+
+        if (size < sizeof(Payload) or size > bufSize)
+            return Error::invalidData("payload size out of bounds");
+
+        if (len > (size - sizeof(Payload)) / sizeof(Record))
+            return Error::invalidData("record count out of bounds");
+
+        if (not _validString(agent))
+            return Error::invalidData("invalid agent string");
+
+        for (usize i = 0; i < len; i++) {
+            auto const& r = records[i];
+
+            if (r.end() < r.start)
+                return Error::invalidData("record range overflows");
+
+            if (i > 0 and r.start < records[i - 1].start)
+                return Error::invalidData("records are not sorted");
+
+            if (r.tag == Tag::BLOB and
+                (not _validString(r.blob.name) or not _validString(r.blob.meta)))
+                return Error::invalidData("invalid blob string");
+        }
+
+        return Ok();
+    }
+
     Record* begin() {
         return records;
     }
@@ -241,6 +310,28 @@ inline constexpr Request requestFb(PixelFormat preferedFormat = PixelFormat::BGR
     return {Tag::FB, 0, (u64)preferedFormat};
 }
 
+// Check the shape produced by HandoverRequests$(): MAGIC first, END last
+// and no tag requested twice. Returns the requests in between.
+inline Res<Slice<Request>> parseRequests(Slice<Request> section) {
+    if (section.len() == 0 or section[0].tag != Tag::MAGIC)
+        return Error::invalidData("requests do not start with MAGIC");
+
+    for (usize i = 1; i < section.len(); i++) {
+        auto tag = section[i].tag;
+        if (tag == Tag::END)
+            return Ok(Slice<Request>{section.buf() + 1, i - 1});
+
+        if (tag == Tag::MAGIC)
+            return Error::invalidData("MAGIC requested twice");
+
+        for (usize j = 1; j < i; j++)
+            if (section[j].tag == tag)
+                return Error::invalidData("tag requested twice");
+    }
+
+    return Error::invalidData("requests are not terminated by END");
+}
+
 inline bool valid(u32 magic, Payload const& payload) {
     if (magic != COOLBOOT)
         return false;
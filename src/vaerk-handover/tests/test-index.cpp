@@ -0,0 +1,86 @@
+#include <karm/test>
+#include <vaerk-handover/builder.h>
+#include <vaerk-handover/index.h>
+
+import Karm.Core;
+
+namespace Handover::Tests {
+
+using namespace Karm::Literals;
+
+// Far more blobs than the table used to hold.
+static constexpr usize BLOBS = 200;
+
+static Str _name(Array<char, 16>& buf, usize i) {
+    usize len = 0;
+    for (char c : Str{"blob-"})
+        buf[len++] = c;
+    usize digits = len;
+    do {
+        buf[len++] = '0' + i % 10;
+        i /= 10;
+    } while (i);
+    for (usize a = digits, b = len - 1; a < b; a++, b--)
+        std::swap(buf[a], buf[b]);
+    return {buf.buf(), len};
+}
+
+struct _Blobs {
+    alignas(u64) Array<u8, 16384> buf = {};
+    Array<Array<char, 16>, BLOBS> names = {};
+
+    Payload const& build() {
+        Builder builder{MutSlice<u8>{buf.buf(), buf.len()}};
+        builder.add(Tag::FREE, 0, {0x100000, 0x100000});
+        for (usize i = 0; i < BLOBS; i++) {
+            Record record{.tag = Tag::BLOB, .start = 0x1000 * (i + 1), .size = 0x1000};
+            record.blob.name = builder.add(_name(names[i], i));
+            record.blob.meta = 0;
+            builder.add(record);
+        }
+        return builder.finalize();
+    }
+};
+
+test$("handover-index-many-blobs") {
+    _Blobs b;
+    auto const& payload = b.build();
+    expectEq$(usize(payload.len), BLOBS + 1);
+
+    Vec<Index::BlobSlot> slots;
+    slots.resize(Index::blobSlots(payload));
+    expect$(slots.len() >= BLOBS * 4 / 3);
+
+    auto index = try$(Index::build(payload, b.buf.len(), {slots.buf(), slots.len()}));
+    for (usize i = 0; i < BLOBS; i++) {
+        auto const* record = index.blobByName(b.names[i].buf());
+        expect$(record != nullptr);
+        expectEq$(record->start, 0x1000u * (i + 1));
+    }
+    expect$(index.blobByName("blob-missing") == nullptr);
+    expectEq$(index.findTag(Tag::FREE)->start, 0x100000u);
+    return Ok();
+}
+
+test$("handover-index-table-too-small") {
+    _Blobs b;
+    auto const& payload = b.build();
+
+    Array<Index::BlobSlot, 64> slots;
+    expect$(not Index::build(payload, b.buf.len(), {slots.buf(), slots.len()}));
+    return Ok();
+}
+
+test$("handover-index-no-blobs") {
+    alignas(u64) Array<u8, 4096> buf = {};
+    Builder builder{MutSlice<u8>{buf.buf(), buf.len()}};
+    builder.add(Tag::FREE, 0, {0x100000, 0x100000});
+    auto const& payload = builder.finalize();
+
+    expectEq$(Index::blobSlots(payload), 0uz);
+    auto index = try$(Index::build(payload, buf.len(), {}));
+    expect$(index.blobByName("anything") == nullptr);
+    return Ok();
+}
+
+} // namespace Handover::Tests
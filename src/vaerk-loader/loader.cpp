@@ -0,0 +1,478 @@
+import Karm.Core;
+import Karm.Sys;
+import Karm.Logger;
+import Karm.Dl.Elf;
+import Vaerk.Acpi;
+import Vaerk.Dtb;
+import Vaerk.Lz4;
+
+#include <vaerk-boot/image.h>
+#include <vaerk-handover/builder.h>
+
+#include "loader.h"
+
+namespace Loader {
+
+// MARK: File ------------------------------------------------------------------
+
+static Res<> _readAt(Efi::FileProtocol* file, u64 offset, void* buf, usize len) {
+    try$(file->setPosition(file, offset));
+
+    u8* dst = static_cast<u8*>(buf);
+    usize done = 0;
+    while (done < len) {
+        usize chunk = min(len - done, CHUNK_SIZE);
+        try$(file->read(file, &chunk, dst + done));
+        if (chunk == 0)
+            return Error::invalidData("unexpected end of kernel file");
+        done += chunk;
+    }
+
+    return Ok();
+}
+
+static Res<usize> _fileSize(Efi::FileProtocol* file) {
+    // Seeking to the largest position moves to the end of the file.
+    try$(file->setPosition(file, ~u64(0)));
+    u64 size = 0;
+    try$(file->getPosition(file, &size));
+    return Ok(size);
+}
+
+static Res<Vec<u8>> _readAll(Efi::FileProtocol* file, usize size) {
+    Vec<u8> buf;
+    buf.resize(size);
+    try$(_readAt(file, 0, buf.buf(), size));
+    return Ok(buf);
+}
+
+static Res<usize> _allocPages(usize size) {
+    usize addr = 0;
+    try$(Efi::bs()->allocatePages(Efi::AllocateType::ANY_PAGES, Efi::MemoryType::LOADER_DATA, alignUp(size, PAGE_SIZE) / PAGE_SIZE, &addr));
+    return Ok(addr);
+}
+
+// MARK: Timing ----------------------------------------------------------------
+
+struct _Timer {
+    Handoff& handoff;
+    Instant start = Sys::instant();
+
+    // Phases end before exitBootServices(), the clock and the console are
+    // only guaranteed while boot services are there.
+    void phase(char const* name) {
+        auto now = Sys::instant();
+        u64 usecs = (now - start).toUSecs();
+        start = now;
+        if (handoff.phasesLen < MAX_PHASES)
+            handoff.phases[handoff.phasesLen++] = {name, usecs};
+        logInfo("loader: {} took {}us", name, usecs);
+    }
+};
+
+// MARK: Kernel ----------------------------------------------------------------
+
+// Offsets into the ELF64 header and section headers, see the System V ABI.
+static constexpr usize ELF_HEADER_SIZE = 64;
+static constexpr usize ELF_PHOFF = 0x20;
+static constexpr usize ELF_SHOFF = 0x28;
+static constexpr usize ELF_PHENTSIZE = 0x36;
+static constexpr usize ELF_PHNUM = 0x38;
+static constexpr usize ELF_SHENTSIZE = 0x3a;
+static constexpr usize ELF_SHNUM = 0x3c;
+static constexpr usize ELF_SHSTRNDX = 0x3e;
+static constexpr usize ELF_SH_NAME = 0x00;
+static constexpr usize ELF_SH_OFFSET = 0x18;
+static constexpr usize ELF_SH_SIZE = 0x20;
+
+template <typename T>
+static T _field(Bytes buf, usize offset) {
+    T value;
+    memcpy(&value, buf.buf() + offset, sizeof(T));
+    return value;
+}
+
+// Read the parts of the kernel ELF its layout is built from: the header,
+// the program and section header tables, the section names and the request
+// section. They land at their file offsets in an otherwise zeroed buffer,
+// which the ELF parser takes as is, segments are only ever read once,
+// straight into their final pages.
+static Res<Vec<u8>> _readElfHeaders(Efi::FileProtocol* kernel, usize kernelSize) {
+    Vec<u8> buf;
+    buf.resize(kernelSize);
+    Bytes bytes{buf.buf(), buf.len()};
+
+    auto read = [&](u64 offset, u64 len) -> Res<> {
+        if (offset > kernelSize or len > kernelSize - offset)
+            return Error::invalidData("kernel headers out of bounds");
+        return _readAt(kernel, offset, buf.buf() + offset, len);
+    };
+
+    try$(read(0, ELF_HEADER_SIZE));
+    u64 shoff = _field<u64>(bytes, ELF_SHOFF);
+    u64 shentsize = _field<u16>(bytes, ELF_SHENTSIZE);
+    u64 shnum = _field<u16>(bytes, ELF_SHNUM);
+    u64 shstrndx = _field<u16>(bytes, ELF_SHSTRNDX);
+    try$(read(_field<u64>(bytes, ELF_PHOFF), u64(_field<u16>(bytes, ELF_PHENTSIZE)) * _field<u16>(bytes, ELF_PHNUM)));
+    try$(read(shoff, shentsize * shnum));
+
+    if (shstrndx >= shnum or shentsize < ELF_SH_SIZE + sizeof(u64))
+        return Error::invalidData("kernel has no section names");
+    u64 names = _field<u64>(bytes, shoff + shstrndx * shentsize + ELF_SH_OFFSET);
+    u64 namesSize = _field<u64>(bytes, shoff + shstrndx * shentsize + ELF_SH_SIZE);
+    try$(read(names, namesSize));
+
+    Str wanted = Handover::REQUEST_SECTION;
+    for (u64 i = 0; i < shnum; i++) {
+        u64 header = shoff + i * shentsize;
+        u64 name = _field<u32>(bytes, header + ELF_SH_NAME);
+        if (name >= namesSize or namesSize - name <= wanted.len())
+            continue;
+        Str candidate{reinterpret_cast<char const*>(buf.buf() + names + name), wanted.len()};
+        if (candidate != wanted or buf[names + name + wanted.len()] != 0)
+            continue;
+        try$(read(_field<u64>(bytes, header + ELF_SH_OFFSET), _field<u64>(bytes, header + ELF_SH_SIZE)));
+        break;
+    }
+
+    return Ok(buf);
+}
+
+// The load layout and requests of the kernel, from its manifest when there
+// is one, otherwise from the ELF through the same code as handover-dump.
+static Res<Vec<u8>> _readLayout(Efi::FileProtocol* volume, Efi::FileProtocol* kernel, usize kernelSize, Config const& config) {
+    if (config.manifest) {
+        Efi::FileProtocol* file = nullptr;
+        try$(volume->open(volume, &file, config.manifest, EFI_FILE_MODE_READ, 0));
+        Defer closeFile = [&] {
+            (void)file->close(file);
+        };
+        return _readAll(file, try$(_fileSize(file)));
+    }
+
+    auto buf = try$(_readElfHeaders(kernel, kernelSize));
+    auto elf = Elf::ElfObject<Elf::Elf64LeAbi>{Bytes{buf.buf(), buf.len()}};
+    if (not elf.validate())
+        return Error::invalidData("kernel is not a valid ELF executable");
+    return Boot::buildImage(elf);
+}
+
+// Loads every segment at `vaddr - KERNEL_BASE`, reading the file contents
+// directly into the allocated pages.
+static Res<urange> _loadSegments(Efi::FileProtocol* file, Handover::Image const& image) {
+    usize start = ~usize(0), end = 0;
+    for (auto const& segment : image) {
+        if (segment.vaddr < Handover::KERNEL_BASE)
+            return Error::invalidData("invalid kernel segment");
+
+        usize paddr = segment.vaddr - Handover::KERNEL_BASE;
+        usize base = alignDown(paddr, PAGE_SIZE);
+        usize limit = alignUp(paddr + segment.memsz, PAGE_SIZE);
+
+        try$(Efi::bs()->allocatePages(Efi::AllocateType::ADDRESS, Efi::MemoryType::LOADER_DATA, (limit - base) / PAGE_SIZE, &base));
+        try$(_readAt(file, segment.offset, reinterpret_cast<void*>(paddr), segment.filesz));
+        memset(reinterpret_cast<u8*>(paddr + segment.filesz), 0, segment.bss());
+
+        start = min(start, base);
+        end = max(end, limit);
+    }
+
+    if (end == 0)
+        return Error::invalidData("kernel has no loadable segments");
+
+    return Ok(urange{start, end - start});
+}
+
+// MARK: Requests --------------------------------------------------------------
+
+static Res<> _honorFb(Handover::Builder& builder) {
+    auto* gop = try$(Efi::locateProtocol<Efi::GraphicsOutputProtocol>());
+    auto* mode = gop->mode;
+    auto* info = mode->info;
+
+    Handover::PixelFormat format;
+    if (info->pixelFormat == Efi::PixelFormat::RED_GREEN_BLUE_RESERVED8_BIT_PER_COLOR)
+        format = Handover::PixelFormat::RGBX8888;
+    else if (info->pixelFormat == Efi::PixelFormat::BLUE_GREEN_RED_RESERVED8_BIT_PER_COLOR)
+        format = Handover::PixelFormat::BGRX8888;
+    else
+        return Error::other("unsupported framebuffer format");
+
+    Handover::Record record = {
+        .tag = Handover::Tag::FB,
+        .start = mode->frameBufferBase,
+        .size = alignUp(mode->frameBufferSize, PAGE_SIZE),
+    };
+    record.fb = {
+        .width = (u16)info->horizontalResolution,
+        .height = (u16)info->verticalResolution,
+        .pitch = (u16)(info->pixelsPerScanLine * 4),
+        .format = format,
+    };
+    builder.add(record);
+    return Ok();
+}
+
+// Size of the table the firmware points at, so that all of it stays
+// reserved and none of it is handed out as FREE memory.
+static usize _tableSize(Handover::Tag tag, usize addr) {
+    if (tag == Handover::Tag::FDT)
+        return reinterpret_cast<Vaerk::Dtb::Header const*>(addr)->totalSize;
+
+    if (tag == Handover::Tag::RSDP) {
+        // ACPI 1.0 RSDPs end right before the length field.
+        auto const* rsdp = reinterpret_cast<Vaerk::Acpi::Rsdp const*>(addr);
+        if (rsdp->isAcpi2())
+            return max<usize>(rsdp->length, sizeof(Vaerk::Acpi::Rsdp));
+        return 20;
+    }
+
+    return PAGE_SIZE;
+}
+
+static void _honorTable(Handover::Builder& builder, Handover::Tag tag, Slice<Ref::Guid> guids) {
+    for (auto const& guid : guids) {
+        auto* table = Efi::st()->lookupConfigurationTable(guid);
+        if (not table)
+            continue;
+        usize addr = reinterpret_cast<usize>(table->table);
+        usize start = alignDown(addr, PAGE_SIZE);
+        usize end = alignUp(addr + _tableSize(tag, addr), PAGE_SIZE);
+        builder.add(tag, 0, {start, end - start});
+        return;
+    }
+    logWarn("loader: no configuration table for {} request", Handover::tagName(tag));
+}
+
+// Blobs are read straight into their final pages, like the kernel.
+static Res<> _honorBlobs(Handover::Builder& builder, Efi::FileProtocol* volume, Slice<BlobFile> blobs) {
+    for (auto const& blob : blobs) {
+        Efi::FileProtocol* file = nullptr;
+        try$(volume->open(volume, &file, blob.path, EFI_FILE_MODE_READ, 0));
+        Defer closeFile = [&] {
+            (void)file->close(file);
+        };
+
+        usize size = try$(_fileSize(file));
+        if (size == 0) {
+            logWarn("loader: skipping empty blob {}", blob.name);
+            continue;
+        }
+        usize addr = try$(_allocPages(size));
+        try$(_readAt(file, 0, reinterpret_cast<void*>(addr), size));
+
+        // The kernel sizes the unpacked blob from the frame header, a frame
+        // without a content size couldn't be unpacked at boot.
+        auto frame = Vaerk::Lz4::peek(Bytes{reinterpret_cast<u8 const*>(addr), size});
+        if (frame and not frame.unwrap().contentSize) {
+            logWarn("loader: skipping blob {}, its lz4 frame has no content size", blob.name);
+            (void)Efi::bs()->freePages(addr, alignUp(size, PAGE_SIZE) / PAGE_SIZE);
+            continue;
+        }
+
+        Handover::Record record = {
+            .tag = Handover::Tag::BLOB,
+            .flags = frame ? Handover::BLOB_LZ4 : 0,
+            .start = addr,
+            .size = size,
+        };
+        record.blob = {
+            .name = (u32)builder.add(blob.name),
+            .meta = 0,
+        };
+        builder.add(record);
+    }
+    return Ok();
+}
+
+static Res<usize> _honorRequests(Handover::Builder& builder, Efi::FileProtocol* volume, Config const& config, Slice<Handover::Request> requests) {
+    usize stackTop = 0;
+
+    for (auto const& request : requests) {
+        switch (request.tag) {
+        case Handover::Tag::SELF:
+            builder.add(Handover::Tag::SELF, 0, {alignDown(reinterpret_cast<usize>(Efi::li()->imageBase), PAGE_SIZE), alignUp(Efi::li()->imageSize, PAGE_SIZE)});
+            break;
+
+        case Handover::Tag::STACK: {
+            usize size = alignUp(request.more ? request.more : 64 * 1024, PAGE_SIZE);
+            usize stack = try$(_allocPages(size));
+            builder.add(Handover::Tag::STACK, 0, {stack, size});
+            stackTop = stack + size;
+            break;
+        }
+
+        case Handover::Tag::RSDP: {
+            Array guids = {Efi::ConfigurationTable::ACPI2_TABLE_GUID, Efi::ConfigurationTable::ACPI_TABLE_GUID};
+            _honorTable(builder, Handover::Tag::RSDP, guids);
+            break;
+        }
+
+        case Handover::Tag::FDT: {
+            Array guids = {Efi::ConfigurationTable::DEVICE_TREE_GUID};
+            _honorTable(builder, Handover::Tag::FDT, guids);
+            break;
+        }
+
+        case Handover::Tag::FB:
+            if (auto res = _honorFb(builder); not res)
+                logWarn("loader: no framebuffer: {}", res.none());
+            break;
+
+        case Handover::Tag::BLOB:
+            try$(_honorBlobs(builder, volume, config.blobs));
+            break;
+
+        default:
+            logWarn("loader: ignoring {} request", request.name());
+            break;
+        }
+    }
+
+    if (not stackTop)
+        return Error::invalidData("kernel did not request a stack");
+
+    return Ok(stackTop);
+}
+
+// MARK: Memory Map ------------------------------------------------------------
+
+// Memory the kernel may reuse once it's done with the payload. Only FREE
+// records are derived from the map: anything not covered is unusable, and
+// the records for the kernel, stack and payload carve themselves out.
+static bool _isUsable(Efi::MemoryType type) {
+    switch (type) {
+    case Efi::MemoryType::CONVENTIONAL_MEMORY:
+    case Efi::MemoryType::BOOT_SERVICES_CODE:
+    case Efi::MemoryType::BOOT_SERVICES_DATA:
+    case Efi::MemoryType::LOADER_CODE:
+    case Efi::MemoryType::LOADER_DATA:
+        return true;
+    default:
+        return false;
+    }
+}
+
+struct _MemoryMap {
+    u8* buf = nullptr;
+    usize cap = 0;
+    usize len = 0;
+    usize key = 0;
+    usize descSize = 0;
+    u32 descVersion = 0;
+
+    Res<> fetch() {
+        len = cap;
+        return Efi::bs()->getMemoryMap(&len, reinterpret_cast<Efi::MemoryDescriptor*>(buf), &key, &descSize, &descVersion);
+    }
+
+    // Allocating the buffer can itself grow the map, so leave some room.
+    Res<> allocate() {
+        len = 0;
+        (void)Efi::bs()->getMemoryMap(&len, nullptr, &key, &descSize, &descVersion);
+        cap = len + 8 * max(descSize, sizeof(Efi::MemoryDescriptor));
+        void* ptr = nullptr;
+        try$(Efi::bs()->allocatePool(Efi::MemoryType::LOADER_DATA, cap, &ptr));
+        buf = static_cast<u8*>(ptr);
+        return Ok();
+    }
+
+    // Called after exitBootServices(), so it must not touch the firmware,
+    // the builder is expected to be quiet by then.
+    void ingest(Handover::Builder& builder) {
+        Array<Handover::Record, 32> batch;
+        usize batchLen = 0;
+
+        for (usize off = 0; off + descSize <= len; off += descSize) {
+            auto const& desc = *reinterpret_cast<Efi::MemoryDescriptor const*>(buf + off);
+            if (not _isUsable(desc.type))
+                continue;
+
+            batch[batchLen++] = {
+                .tag = Handover::Tag::FREE,
+                .start = desc.physicalStart,
+                .size = desc.numberOfPages * PAGE_SIZE,
+            };
+
+            if (batchLen == batch.len()) {
+                builder.addBatch({batch.buf(), batchLen});
+                batchLen = 0;
+            }
+        }
+
+        builder.addBatch({batch.buf(), batchLen});
+    }
+};
+
+static Res<> _exitBootServices(_MemoryMap& map) {
+    try$(map.fetch());
+
+    // The map key is stale if anything allocated in between, retry once.
+    if (Efi::bs()->exitBootServices(Efi::imageHandle(), map.key))
+        return Ok();
+
+    try$(map.fetch());
+    return Efi::bs()->exitBootServices(Efi::imageHandle(), map.key);
+}
+
+// MARK: Load ------------------------------------------------------------------
+
+// Everything that needs boot services, including the firmware heap behind
+// the layout buffer, which must be released before exiting them.
+static Res<> _prepare(Config const& config, Handoff& handoff, Handover::Builder& builder, _Timer& timer) {
+    auto* fs = try$(Efi::openProtocol<Efi::SimpleFileSystemProtocol>(reinterpret_cast<Efi::Handle>(Efi::li()->deviceHandle)));
+    Efi::FileProtocol* volume = nullptr;
+    try$(fs->openVolume(fs, &volume));
+    Defer closeVolume = [&] {
+        (void)volume->close(volume);
+    };
+    Efi::FileProtocol* file = nullptr;
+    try$(volume->open(volume, &file, config.kernel, EFI_FILE_MODE_READ, 0));
+    Defer closeFile = [&] {
+        (void)file->close(file);
+    };
+    usize kernelSize = try$(_fileSize(file));
+    timer.phase("open");
+
+    auto layout = try$(_readLayout(volume, file, kernelSize, config));
+    auto const& image = *reinterpret_cast<Handover::Image const*>(layout.buf());
+    try$(image.validate(layout.len(), kernelSize));
+    auto requests = try$(image.requests(layout.len()));
+    timer.phase("layout");
+
+    auto kernel = try$(_loadSegments(file, image));
+    handoff.entry = image.entry;
+    builder.add(Handover::Tag::KERNEL, 0, kernel);
+    timer.phase("kernel");
+
+    handoff.stackTop = try$(_honorRequests(builder, volume, config, requests));
+    timer.phase("payload");
+
+    return Ok();
+}
+
+Res<Handoff> load(Config const& config) {
+    Handoff handoff{};
+    _Timer timer{handoff};
+
+    usize payload = try$(_allocPages(PAYLOAD_SIZE));
+    Handover::Builder builder{MutSlice<u8>{reinterpret_cast<u8*>(payload), PAYLOAD_SIZE}};
+    builder.agent("vaerk-loader");
+    builder.add(Handover::Tag::LOADER, 0, {payload, PAYLOAD_SIZE});
+    try$(_prepare(config, handoff, builder, timer));
+
+    _MemoryMap map;
+    try$(map.allocate());
+    timer.phase("memory map");
+
+    // The console goes away with boot services, drops are counted instead.
+    builder.quiet = true;
+    try$(_exitBootServices(map));
+    map.ingest(builder);
+    handoff.payload = &builder.finalize();
+    handoff.dropped = builder.dropped;
+
+    return Ok(handoff);
+}
+
+} // namespace Loader
@@ -0,0 +1,58 @@
+#pragma once
+
+import Karm.Core;
+
+#include <vaerk-efi/base.h>
+#include <vaerk-handover/spec.h>
+
+namespace Loader {
+
+static constexpr usize PAGE_SIZE = 4096;
+
+// Kernel bytes are read straight into their final pages in chunks of this
+// size, large enough to keep the number of firmware calls low.
+static constexpr usize CHUNK_SIZE = 2 * 1024 * 1024;
+
+static constexpr usize PAYLOAD_SIZE = 64 * 1024;
+
+static constexpr usize MAX_PHASES = 8;
+
+struct Phase {
+    char const* name;
+    u64 usecs;
+};
+
+// Everything needed to enter the kernel. Boot services have been exited,
+// addresses other than `entry` are physical and it's up to the caller to
+// map them before jumping.
+struct Handoff {
+    usize entry;
+    usize stackTop;
+    Handover::Payload* payload;
+    Array<Phase, MAX_PHASES> phases;
+    usize phasesLen;
+    // Records and strings the payload couldn't take, they can't be logged
+    // once boot services are gone.
+    usize dropped;
+};
+
+// A file handed over to the kernel as a BLOB record when it requests
+// blobs, LZ4 frames are flagged as such and must carry their content size.
+struct BlobFile {
+    Str name; // Name of the record, eg. "initrd"
+    u16 const* path;
+};
+
+struct Config {
+    u16 const* kernel;
+    // Load layout written by `handover-dump --manifest`, without one it is
+    // built from the headers and request section of the kernel ELF.
+    u16 const* manifest = nullptr;
+    Slice<BlobFile> blobs = {};
+};
+
+// Load the kernel on the volume the loader was started from, honoring its
+// `.handover` requests. All paths are relative to that volume.
+Res<Handoff> load(Config const& config);
+
+} // namespace Loader
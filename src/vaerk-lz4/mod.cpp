@@ -0,0 +1,258 @@
+export module Vaerk.Lz4;
+
+import Karm.Core;
+
+using namespace Karm;
+
+namespace Vaerk::Lz4 {
+
+export constexpr u32 MAGIC = 0x184d2204;
+
+static constexpr usize MIN_MATCH = 4;
+
+// MARK: Frame -----------------------------------------------------------------
+
+export struct Frame {
+    static constexpr u8 VERSION_MASK = 0b1100'0000;
+    static constexpr u8 VERSION = 0b0100'0000;
+    static constexpr u8 BLOCK_INDEPENDENCE = 1 << 5;
+    static constexpr u8 BLOCK_CHECKSUM = 1 << 4;
+    static constexpr u8 CONTENT_SIZE = 1 << 3;
+    static constexpr u8 CONTENT_CHECKSUM = 1 << 2;
+    static constexpr u8 DICT_ID = 1 << 0;
+
+    u8 flags;
+    usize maxBlockSize;
+    Opt<usize> contentSize;
+    usize headerSize;
+
+    bool blockChecksum() const {
+        return flags & BLOCK_CHECKSUM;
+    }
+
+    bool contentChecksum() const {
+        return flags & CONTENT_CHECKSUM;
+    }
+};
+
+static u32 _le32(u8 const* buf) {
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | (u32(buf[3]) << 24);
+}
+
+static u64 _le64(u8 const* buf) {
+    return _le32(buf) | (u64(_le32(buf + 4)) << 32);
+}
+
+// Parse the frame descriptor, checksums are not verified.
+export Res<Frame> peek(Bytes in) {
+    if (in.len() < 7 or _le32(in.buf()) != MAGIC)
+        return Error::invalidData("not an lz4 frame");
+
+    Frame frame{};
+    frame.flags = in[4];
+    if ((frame.flags & Frame::VERSION_MASK) != Frame::VERSION)
+        return Error::invalidData("unsupported lz4 frame version");
+
+    if (frame.flags & Frame::DICT_ID)
+        return Error::invalidData("lz4 dictionaries are not supported");
+
+    usize blockSizeId = (in[5] >> 4) & 0b111;
+    if (blockSizeId < 4)
+        return Error::invalidData("invalid lz4 block size");
+    frame.maxBlockSize = usize(1) << (8 + 2 * blockSizeId);
+
+    usize off = 6;
+    if (frame.flags & Frame::CONTENT_SIZE) {
+        if (in.len() < off + 8 + 1)
+            return Error::invalidData("truncated lz4 frame header");
+        frame.contentSize = _le64(in.buf() + off);
+        off += 8;
+    }
+
+    frame.headerSize = off + 1; // Header checksum
+    return Ok(frame);
+}
+
+// Room to leave between the end of the compressed data and the end of the
+// buffer to decompress it in place, with the output starting at the
+// beginning of the buffer.
+export constexpr usize inPlaceMargin(usize compressedSize) {
+    return (compressedSize >> 8) + 32;
+}
+
+// MARK: Decoder ---------------------------------------------------------------
+
+// Decodes a frame one block at a time, so the caller can interleave
+// decompression with reading the input or releasing consumed memory.
+//
+// The output must be contiguous since blocks may reference previous ones,
+// but it may overlap the input as long as it starts before it, see
+// inPlaceMargin().
+export struct Decoder {
+    Frame _frame;
+    Bytes _in;
+    MutBytes _out;
+    usize _ip = 0;
+    usize _op = 0;
+    bool _done = false;
+
+    static Res<Decoder> open(Bytes in, MutBytes out) {
+        auto frame = try$(peek(in));
+        if (frame.contentSize and *frame.contentSize > out.len())
+            return Error::outOfMemory("lz4 output buffer too small");
+
+        Decoder decoder;
+        decoder._frame = frame;
+        decoder._in = in;
+        decoder._out = out;
+        decoder._ip = frame.headerSize;
+        return Ok(decoder);
+    }
+
+    Frame const& frame() const {
+        return _frame;
+    }
+
+    usize consumed() const {
+        return _ip;
+    }
+
+    usize written() const {
+        return _op;
+    }
+
+    bool done() const {
+        return _done;
+    }
+
+    // When decoding in place the output must never catch up with the input
+    // that is still to be read.
+    bool _overrun(usize ip) const {
+        u8 const* write = _out.buf() + _op;
+        u8 const* read = _in.buf() + ip;
+        return read >= _out.buf() and read < _out.buf() + _out.len() and write > read;
+    }
+
+    Res<> _literals(usize ip, usize len) {
+        if (_op + len > _out.len())
+            return Error::invalidData("lz4 literals overflow output");
+        u8* dst = _out.buf() + _op;
+        u8 const* src = _in.buf() + ip;
+        for (usize i = 0; i < len; i++)
+            dst[i] = src[i];
+        _op += len;
+        return Ok();
+    }
+
+    Res<> _match(usize offset, usize len) {
+        if (offset == 0 or offset > _op)
+            return Error::invalidData("lz4 match offset out of bounds");
+        if (_op + len > _out.len())
+            return Error::invalidData("lz4 match overflows output");
+
+        // Overlapping matches repeat the pattern, so copy forward byte by byte.
+        u8* dst = _out.buf() + _op;
+        u8 const* src = dst - offset;
+        for (usize i = 0; i < len; i++)
+            dst[i] = src[i];
+        _op += len;
+        return Ok();
+    }
+
+    Res<usize> _length(usize& ip, usize end, usize len) {
+        if (len != 15)
+            return Ok(len);
+        u8 b;
+        do {
+            if (ip >= end)
+                return Error::invalidData("truncated lz4 length");
+            b = _in[ip++];
+            len += b;
+        } while (b == 255);
+        return Ok(len);
+    }
+
+    Res<> _block(usize ip, usize end) {
+        while (ip < end) {
+            u8 token = _in[ip++];
+
+            usize lit = try$(_length(ip, end, token >> 4));
+            if (lit > end - ip)
+                return Error::invalidData("lz4 literals overflow block");
+            try$(_literals(ip, lit));
+            ip += lit;
+
+            if (_overrun(ip))
+                return Error::invalidData("lz4 in place output overran input");
+
+            // The last sequence of a block only has literals.
+            if (ip == end)
+                break;
+
+            if (end - ip < 2)
+                return Error::invalidData("truncated lz4 match offset");
+            usize offset = _in[ip] | (_in[ip + 1] << 8);
+            ip += 2;
+
+            usize len = try$(_length(ip, end, token & 0xf)) + MIN_MATCH;
+            try$(_match(offset, len));
+
+            if (_overrun(ip))
+                return Error::invalidData("lz4 in place output overran input");
+        }
+        return Ok();
+    }
+
+    // Decode the next block, returns false once the frame is finished.
+    Res<bool> step() {
+        if (_done)
+            return Ok(false);
+
+        if (_in.len() - _ip < 4)
+            return Error::invalidData("truncated lz4 block header");
+        u32 header = _le32(_in.buf() + _ip);
+        _ip += 4;
+
+        if (header == 0) {
+            if (_frame.contentChecksum())
+                _ip += 4;
+            if (_ip > _in.len())
+                return Error::invalidData("truncated lz4 content checksum");
+            if (_frame.contentSize and *_frame.contentSize != _op)
+                return Error::invalidData("lz4 content size mismatch");
+            _done = true;
+            return Ok(false);
+        }
+
+        usize size = header & 0x7fffffff;
+        bool raw = header & 0x80000000;
+        if (size > _frame.maxBlockSize or size > _in.len() - _ip)
+            return Error::invalidData("lz4 block out of bounds");
+
+        if (raw)
+            try$(_literals(_ip, size));
+        else
+            try$(_block(_ip, _ip + size));
+
+        _ip += size;
+        if (_frame.blockChecksum())
+            _ip += 4;
+        if (_ip > _in.len())
+            return Error::invalidData("truncated lz4 block checksum");
+
+        return Ok(true);
+    }
+
+    Res<usize> run() {
+        while (try$(step()))
+            ;
+        return Ok(_op);
+    }
+};
+
+export Res<usize> decompress(Bytes in, MutBytes out) {
+    auto decoder = try$(Decoder::open(in, out));
+    return decoder.run();
+}
+
+} // namespace Vaerk::Lz4
@@ -0,0 +1,306 @@
+export module Vaerk.Pmm;
+
+import Karm.Core;
+
+using namespace Karm;
+
+namespace Vaerk::Pmm {
+
+export constexpr usize PAGE_SIZE = 4096;
+
+export constexpr usize pageAlignDown(usize addr) {
+    return addr & ~(PAGE_SIZE - 1);
+}
+
+export constexpr usize pageAlignUp(usize addr) {
+    return pageAlignDown(addr + PAGE_SIZE - 1);
+}
+
+// MARK: Buddy -----------------------------------------------------------------
+
+// A binary buddy allocator over a physical span, with one free list per
+// order. Its frame array is supplied by the caller so that it can be
+// carved out of the memory it manages.
+export struct Buddy {
+    static constexpr usize MAX_ORDER = 19; // Blocks up to 1GiB
+    static constexpr u32 NIL = 0xffffffff;
+
+    struct Frame {
+        u32 next = NIL;
+        u32 prev = NIL;
+        u8 order = 0;
+        bool free = false;
+    };
+
+    usize _base = 0;
+    usize _len = 0; // In pages
+    MutSlice<Frame> _frames;
+    Array<u32, MAX_ORDER> _heads;
+    usize _free = 0; // In pages
+
+    static usize framesFor(urange span) {
+        return pageAlignUp(span.size) / PAGE_SIZE;
+    }
+
+    static usize metadataSize(urange span) {
+        return framesFor(span) * sizeof(Frame);
+    }
+
+    static usize orderFor(usize size) {
+        usize order = 0;
+        while ((PAGE_SIZE << order) < size)
+            order++;
+        return order;
+    }
+
+    // Nothing is free until release() is called.
+    Buddy(usize base, MutSlice<Frame> frames)
+        : _base(pageAlignDown(base)),
+          _len(frames.len()),
+          _frames(frames) {
+        for (auto& frame : _frames)
+            frame = {};
+        for (auto& head : _heads)
+            head = NIL;
+    }
+
+    usize freePages() const {
+        return _free;
+    }
+
+    urange span() const {
+        return {_base, _len * PAGE_SIZE};
+    }
+
+    u32 _index(usize addr) const {
+        return (addr - _base) / PAGE_SIZE;
+    }
+
+    usize _addr(u32 index) const {
+        return _base + index * PAGE_SIZE;
+    }
+
+    void _push(u32 index, usize order) {
+        auto& frame = _frames[index];
+        frame.next = _heads[order];
+        frame.prev = NIL;
+        frame.order = order;
+        frame.free = true;
+        if (frame.next != NIL)
+            _frames[frame.next].prev = index;
+        _heads[order] = index;
+    }
+
+    void _unlink(u32 index) {
+        auto& frame = _frames[index];
+        if (frame.prev != NIL)
+            _frames[frame.prev].next = frame.next;
+        else
+            _heads[frame.order] = frame.next;
+        if (frame.next != NIL)
+            _frames[frame.next].prev = frame.prev;
+        frame.next = frame.prev = NIL;
+        frame.free = false;
+    }
+
+    bool _contains(usize addr, usize order) const {
+        return addr >= _base and
+               addr - _base + (PAGE_SIZE << order) <= _len * PAGE_SIZE;
+    }
+
+    Res<usize> alloc(usize order) {
+        if (order >= MAX_ORDER)
+            return Error::invalidInput("order too large");
+
+        usize k = order;
+        while (k < MAX_ORDER and _heads[k] == NIL)
+            k++;
+        if (k == MAX_ORDER)
+            return Error::outOfMemory("no free block large enough");
+
+        u32 index = _heads[k];
+        _unlink(index);
+
+        // Give back the upper halves until the block has the right size.
+        while (k > order) {
+            k--;
+            _push(index + (1u << k), k);
+        }
+
+        _free -= usize(1) << order;
+        return Ok(_addr(index));
+    }
+
+    Res<urange> allocRange(usize size) {
+        usize order = orderFor(size);
+        auto addr = try$(alloc(order));
+        return Ok(urange{addr, PAGE_SIZE << order});
+    }
+
+    void free(usize addr, usize order) {
+        _free += usize(1) << order;
+
+        while (order + 1 < MAX_ORDER) {
+            usize buddy = addr ^ (PAGE_SIZE << order);
+            if (not _contains(buddy, order))
+                break;
+
+            auto const& frame = _frames[_index(buddy)];
+            if (not frame.free or frame.order != order)
+                break;
+
+            _unlink(_index(buddy));
+            addr = min(addr, buddy);
+            order++;
+        }
+
+        _push(_index(addr), order);
+    }
+
+    // Hand a range of memory over to the allocator, split into the largest
+    // naturally aligned blocks it contains.
+    void release(urange range) {
+        usize start = max(pageAlignUp(range.start), _base);
+        usize end = min(pageAlignDown(range.end()), _base + _len * PAGE_SIZE);
+
+        while (start < end) {
+            usize order = 0;
+            while (order + 1 < MAX_ORDER and
+                   (start & ((PAGE_SIZE << (order + 1)) - 1)) == 0 and
+                   start + (PAGE_SIZE << (order + 1)) <= end)
+                order++;
+            free(start, order);
+            start += PAGE_SIZE << order;
+        }
+    }
+};
+
+// MARK: Pool ------------------------------------------------------------------
+
+// The global buddy allocator behind a lock. The batch operations take the
+// lock once for many pages so that per-CPU caches rarely contend on it.
+export struct Pool {
+    Lock _lock;
+    Buddy _buddy;
+
+    Pool(Buddy buddy)
+        : _buddy(buddy) {}
+
+    Res<usize> alloc(usize order) {
+        LockScope scope{_lock};
+        return _buddy.alloc(order);
+    }
+
+    void free(usize addr, usize order) {
+        LockScope scope{_lock};
+        _buddy.free(addr, order);
+    }
+
+    usize allocBatch(MutSlice<usize> pages) {
+        LockScope scope{_lock};
+        for (usize i = 0; i < pages.len(); i++) {
+            auto page = _buddy.alloc(0);
+            if (not page)
+                return i;
+            pages[i] = page.unwrap();
+        }
+        return pages.len();
+    }
+
+    void freeBatch(Slice<usize> pages) {
+        LockScope scope{_lock};
+        for (auto page : pages)
+            _buddy.free(page, 0);
+    }
+
+    usize freePages() {
+        LockScope scope{_lock};
+        return _buddy.freePages();
+    }
+};
+
+// MARK: Page Cache ------------------------------------------------------------
+
+// A per-CPU magazine of single pages in front of the pool. It is owned by
+// one CPU and only touches the pool when it runs empty or fills past its
+// high watermark.
+export struct PageCache {
+    static constexpr usize CAPACITY = 128;
+
+    struct Config {
+        usize low = 16;
+        usize high = 96;
+        usize batch = 32;
+    };
+
+    struct Stats {
+        usize hits = 0;
+        usize misses = 0;
+        usize refills = 0;
+        usize drains = 0;
+
+        f64 hitRate() const {
+            usize total = hits + misses;
+            return total ? f64(hits) / f64(total) : 0;
+        }
+    };
+
+    Pool* _pool;
+    Config _config;
+    Array<usize, CAPACITY> _pages;
+    usize _len = 0;
+    Stats _stats;
+
+    PageCache(Pool& pool, Config config = {})
+        : _pool(&pool), _config(config) {
+        _config.high = max(min(_config.high, CAPACITY), usize(1));
+        _config.low = min(_config.low, _config.high - 1);
+        _config.batch = max(min(_config.batch, CAPACITY), usize(1));
+    }
+
+    Stats const& stats() const {
+        return _stats;
+    }
+
+    usize len() const {
+        return _len;
+    }
+
+    void _refill() {
+        _stats.refills++;
+        _len += _pool->allocBatch(MutSlice<usize>{_pages.buf() + _len, _config.batch - _len});
+    }
+
+    void _drain(usize target) {
+        _stats.drains++;
+        _pool->freeBatch(Slice<usize>{_pages.buf() + target, _len - target});
+        _len = target;
+    }
+
+    Res<usize> alloc() {
+        if (_len) {
+            _stats.hits++;
+            return Ok(_pages[--_len]);
+        }
+
+        _stats.misses++;
+        _refill();
+        if (not _len)
+            return Error::outOfMemory("pool exhausted");
+        return Ok(_pages[--_len]);
+    }
+
+    void free(usize page) {
+        if (_len >= _config.high)
+            _drain(_config.low);
+        _pages[_len++] = page;
+    }
+
+    // Give every cached page back, e.g. before a CPU goes offline.
+    void flush() {
+        if (_len)
+            _drain(0);
+    }
+};
+
+} // namespace Vaerk::Pmm
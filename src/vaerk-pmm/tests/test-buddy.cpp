@@ -0,0 +1,92 @@
+#include <karm/test>
+
+import Karm.Core;
+import Vaerk.Pmm;
+
+namespace Vaerk::Pmm::Tests {
+
+// The allocator never touches the memory it manages, any base will do.
+static constexpr usize BASE = 0x1'0000'0000;
+
+struct _Buddy {
+    Vec<Buddy::Frame> frames;
+    Buddy buddy;
+
+    _Buddy(usize pages)
+        : frames(_frames(pages)),
+          buddy(BASE, MutSlice<Buddy::Frame>{frames.buf(), frames.len()}) {}
+
+    static Vec<Buddy::Frame> _frames(usize pages) {
+        Vec<Buddy::Frame> frames;
+        frames.resize(pages);
+        return frames;
+    }
+};
+
+test$("buddy-starts-empty") {
+    _Buddy b{16};
+    expectEq$(b.buddy.freePages(), 0uz);
+    expect$(not b.buddy.alloc(0));
+    return Ok();
+}
+
+test$("buddy-release-clips-to-pages") {
+    _Buddy b{16};
+    // Partial pages at both ends, and a tail past the span.
+    b.buddy.release({BASE + 0x800, 32 * PAGE_SIZE});
+    expectEq$(b.buddy.freePages(), 15uz);
+    return Ok();
+}
+
+test$("buddy-alloc-is-aligned") {
+    _Buddy b{64};
+    b.buddy.release({BASE + PAGE_SIZE, 63 * PAGE_SIZE});
+
+    for (usize order = 0; order < 5; order++) {
+        auto addr = try$(b.buddy.alloc(order));
+        expectEq$((addr - BASE) % (PAGE_SIZE << order), 0uz);
+    }
+    expectEq$(b.buddy.freePages(), 63uz - 31uz);
+    return Ok();
+}
+
+test$("buddy-exhaust-and-coalesce") {
+    _Buddy b{16};
+    b.buddy.release({BASE, 16 * PAGE_SIZE});
+
+    Array<usize, 16> pages = {};
+    for (auto& page : pages)
+        page = try$(b.buddy.alloc(0));
+    expect$(not b.buddy.alloc(0));
+    expectEq$(b.buddy.freePages(), 0uz);
+
+    for (auto page : pages)
+        b.buddy.free(page, 0);
+    expectEq$(b.buddy.freePages(), 16uz);
+
+    // Every page merged back into a single block.
+    auto block = try$(b.buddy.alloc(4));
+    expectEq$(block, BASE);
+    return Ok();
+}
+
+test$("buddy-alloc-range") {
+    _Buddy b{32};
+    b.buddy.release({BASE, 32 * PAGE_SIZE});
+
+    auto range = try$(b.buddy.allocRange(3 * PAGE_SIZE));
+    expectEq$(range.size, 4 * PAGE_SIZE);
+    expectEq$(b.buddy.freePages(), 28uz);
+    expect$(not b.buddy.allocRange(32 * PAGE_SIZE));
+    return Ok();
+}
+
+test$("buddy-alloc-rejects-large-orders") {
+    _Buddy b{16};
+    b.buddy.release({BASE, 16 * PAGE_SIZE});
+    expect$(not b.buddy.alloc(Buddy::MAX_ORDER));
+    expect$(not b.buddy.alloc(5));
+    return Ok();
+}
+
+} // namespace Vaerk::Pmm::Tests
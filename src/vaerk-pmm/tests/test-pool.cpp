@@ -0,0 +1,134 @@
+#include <atomic>
+#include <karm/test>
+#include <thread>
+
+import Karm.Core;
+import Vaerk.Pmm;
+
+namespace Vaerk::Pmm::Tests {
+
+// Host threads stand in for CPUs, each one owning a page cache in front of
+// the shared pool.
+static constexpr usize THREADS = 8;
+static constexpr usize ROUNDS = 2000;
+static constexpr usize PAGES = 4096;
+static constexpr usize STRESS_BASE = 0x2'0000'0000;
+
+static Vec<Buddy::Frame> _frames(usize pages) {
+    Vec<Buddy::Frame> frames;
+    frames.resize(pages);
+    return frames;
+}
+
+static Buddy _released(Vec<Buddy::Frame>& frames) {
+    Buddy buddy{STRESS_BASE, MutSlice<Buddy::Frame>{frames.buf(), frames.len()}};
+    buddy.release(buddy.span());
+    return buddy;
+}
+
+struct _Stress {
+    Vec<Buddy::Frame> frames = _frames(PAGES);
+    Pool pool{_released(frames)};
+    Array<std::atomic<u32>, PAGES> owners = {};
+    std::atomic<bool> failed = false;
+
+    std::atomic<u32>& _owner(usize page) {
+        return owners[(page - STRESS_BASE) / PAGE_SIZE];
+    }
+
+    // Allocate and free bursts larger than the cache, every page must
+    // only ever be held by one thread at a time.
+    void run(u32 id, PageCache::Config config) {
+        PageCache cache{pool, config};
+        Array<usize, PageCache::CAPACITY * 2> held = {};
+        usize len = 0;
+        u64 rng = id + 1;
+
+        for (usize round = 0; round < ROUNDS; round++) {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            usize burst = 1 + rng % held.len();
+
+            while (len < burst) {
+                auto page = cache.alloc();
+                if (not page)
+                    break;
+                u32 expected = 0;
+                if (not _owner(page.unwrap()).compare_exchange_strong(expected, id + 1))
+                    failed = true;
+                held[len++] = page.unwrap();
+            }
+
+            usize keep = rng % (len + 1);
+            while (len > keep) {
+                auto page = held[--len];
+                if (_owner(page).exchange(0) != id + 1)
+                    failed = true;
+                cache.free(page);
+            }
+        }
+
+        while (len > 0) {
+            auto page = held[--len];
+            _owner(page).store(0);
+            cache.free(page);
+        }
+        cache.flush();
+    }
+
+    Res<> stress(PageCache::Config config) {
+        Array<std::thread, THREADS> threads;
+        for (u32 id = 0; id < THREADS; id++)
+            threads[id] = std::thread{[this, id, config] {
+                run(id, config);
+            }};
+        for (auto& thread : threads)
+            thread.join();
+
+        if (failed)
+            return Error::other("a page was handed out twice");
+        if (pool.freePages() != PAGES)
+            return Error::other("pages were lost");
+        return Ok();
+    }
+};
+
+test$("pool-threaded-stress") {
+    _Stress stress;
+    return stress.stress({});
+}
+
+test$("pool-threaded-stress-small-cache") {
+    // Refill and drain on almost every operation.
+    _Stress stress;
+    return stress.stress({.low = 1, .high = 2, .batch = 2});
+}
+
+test$("page-cache-watermarks") {
+    auto frames = _frames(256);
+    Pool pool{_released(frames)};
+    PageCache cache{pool, {.low = 4, .high = 8, .batch = 6}};
+
+    Array<usize, 10> pages = {};
+    for (auto& page : pages)
+        page = try$(cache.alloc());
+    expectEq$(cache.len(), 2uz);
+    expectEq$(cache.stats().refills, 2uz);
+    expectEq$(cache.stats().hits, 8uz);
+    expectEq$(pool.freePages(), 256uz - 12uz);
+
+    // Past the high watermark, the cache drains down to the low one.
+    for (auto page : pages)
+        cache.free(page);
+    expectEq$(cache.len(), 8uz);
+    expectEq$(cache.stats().drains, 1uz);
+    expectEq$(pool.freePages(), 256uz - 8uz);
+
+    cache.flush();
+    expectEq$(cache.len(), 0uz);
+    expectEq$(pool.freePages(), 256uz);
+    return Ok();
+}
+
+} // namespace Vaerk::Pmm::Tests